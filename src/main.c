@@ -18,10 +18,43 @@
 #include <time.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <sys/inotify.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #define SIMPLR_VERSION "v.1"
 #define SIMPLR_TAB_STOP 8
 #define SIMPLR_QUIT_TIMES 1
+#define SIMPLR_INPUT_SIZE 65536 /* Size of the input ring buffer, has to be a power of two */
+#define SIMPLR_ESC_TIMEOUT 100 /* Milliseconds to wait for the rest of an escape sequence */
+#define SIMPLR_PASTE_TIMEOUT 1000 /* Milliseconds without input after which a paste missing its end marker is ended */
+#define SIMPLR_MESSAGE_TIME 5 /* Seconds a status message stays on screen */
+#define SIMPLR_RENDER_CACHE 1024 /* Rows away from the screen lose their render buffers once more rows than this hold one */
+#define SIMPLR_BACKGROUND_SAVE (16 << 20) /* Documents longer than this many bytes are saved on a thread while editing goes on */
+#define SIMPLR_LOAD_CHUNK (16 << 20) /* Bytes of a file indexed by the loader thread before its rows are added and drawn */
+#define SIMPLR_SAVE_CHUNK (1 << 20) /* Size of the blocks edited rows are copied into for a save */
+#define SIMPLR_SEARCH_CHUNK 16384 /* Rows a search worker counts at a time */
+#define SIMPLR_WORK_REFRESH 50 /* Milliseconds between redraws while workers report results */
+#define SIMPLR_MAX_WORKERS 64
+#define SIMPLR_UNDO_BLOCK (64 << 10) /* Size of the blocks undo records are allocated from */
+#define SIMPLR_JOURNAL_SYNC 1000 /* Milliseconds between writes of the edit journal, each write is synced to disk */
+#define SIMPLR_HL_BUDGET (64 << 10) /* Bytes of stale rows lexed before a redraw, longer runs are lexed on a thread */
+#define SIMPLR_HL_CHUNK (256 << 10) /* Bytes the highlighter thread lexes each time it holds the rows */
+#define SIMPLR_PERF_BUCKETS 48 /* Power of two buckets of the latency histograms, the last one holds everything slower */
+#define SIMPLR_SLAB_SIZE (256 << 10) /* Size of the slabs row memory is carved from */
+#define SIMPLR_TRACE_EVENTS 8192 /* Timed spans kept for the trace written on exit, has to be a power of two */
+#define SIMPLR_FOLLOW_CHUNK (1 << 20) /* Bytes of a followed file read at a time, the screen is drawn between reads */
+#define SIMPLR_REGEX_STATES 1024 /* DFA states a pattern keeps before they are thrown away and built again */
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 
@@ -40,7 +73,9 @@ enum editorKey
 	PAGE_DOWN,
 	DEL,
 	HOME,
-	END
+	END,
+	PASTE_START, /* Bracketed paste, the terminal wraps pasted text in these */
+	PASTE_END
 };
 
 /* ====== DATA ======*/
@@ -51,8 +86,352 @@ typedef struct editor_row
 	char *chars;
 	int rsize; 
 	char *render;
+	int flags;
+	int cap; /* Bytes allocated for chars, 0 while the row points into the mapped file */
+	int gap; /* Edits happen at the gap, the characters after it sit at the end of the allocation */
+	unsigned char *hl; /* Highlight class of every render column, built together with the render when the row is drawn */
+	unsigned char hl_open; /* Lexer state hl was built from */
+	unsigned char hl_state; /* Lexer state at the end of the row, the next row starts in it */
 } editor_row;
 
+/* Row flags */
+#define ROW_MAPPED 1 /* chars points into the memory mapped file and is copied on the first edit */
+#define ROW_RENDER_ALIAS 2 /* render points to chars because the row has no tabs */
+#define ROW_RENDER_VALID 4 /* render matches chars, every edit clears it and the row is rendered again when drawn */
+#define ROW_HL_VALID 8 /* hl matches render, it is built again when the render is or when the row starts in another state */
+
+/* Highlight classes */
+enum editorHighlight
+{
+	HL_NORMAL = 0,
+	HL_COMMENT,
+	HL_MLCOMMENT,
+	HL_KEYWORD1,
+	HL_KEYWORD2,
+	HL_STRING,
+	HL_NUMBER
+};
+
+/* Lexer states a row can end in */
+#define HL_STATE_NORMAL 0
+#define HL_STATE_COMMENT 1 /* Inside a multiline comment */
+#define HL_STATE_UNKNOWN 255 /* The row was never lexed */
+
+#define HL_HIGHLIGHT_NUMBERS (1<<0)
+#define HL_HIGHLIGHT_STRINGS (1<<1)
+
+/* How the files of one language are highlighted */
+struct editorSyntax
+{
+	char *filetype;
+	char **filematch; /* File name endings that select the syntax */
+	char **keywords; /* Keywords ending in | are types and get the second keyword colour */
+	char *singleline_comment_start;
+	char *multiline_comment_start;
+	char *multiline_comment_end;
+	int flags;
+};
+
+/* Row text, renders and highlights are allocated from slabs in size classes, without a malloc header per block.
+ * Blocks larger than the largest class come from malloc and are kept on a list, so a whole store is freed at once. */
+#define ROW_STORE_CLASSES 16
+
+struct rowSlab
+{
+	struct rowSlab *next;
+	char data[];
+};
+
+struct rowLarge
+{
+	struct rowLarge *prev, *next;
+	long long size;
+	long long pad; /* Keeps the block after the header 16 byte aligned */
+};
+
+struct rowStore
+{
+	void *free[ROW_STORE_CLASSES]; /* Freed blocks of every class, linked through their first bytes */
+	struct rowSlab *slabs;
+	char *bump, *bumpend; /* Part of the newest slab no block was carved from yet */
+	struct rowLarge *large;
+	long long blocks[ROW_STORE_CLASSES]; /* Blocks of every class in use */
+	long long used; /* Bytes of the blocks in use, the large ones included */
+	long long slab_bytes;
+	long long large_blocks, large_bytes;
+};
+
+/* Rows of a loaded file are described by the row index until they are used, a few bytes a row in parallel arrays
+ * that passes over the whole document stream through. Offsets are 64 bit, so files past 2 GB load like any other.
+ * The arrays come in blocks that never move once they are made, so the loader thread fills a block while the main
+ * thread reads the rows before. ROW_INDEX_BLOCK is a multiple of ROW_LEAF_MAX, the rows of a leaf are in one block. */
+#define ROW_INDEX_BLOCK 65536
+struct rowIndexBlock
+{
+	long long off[ROW_INDEX_BLOCK]; /* Where every row starts in the mapping */
+	int len[ROW_INDEX_BLOCK]; /* Length of every row without its newline and a \r before it */
+	unsigned char flags[ROW_INDEX_BLOCK];
+};
+
+struct rowIndex
+{
+	struct rowIndexBlock **blocks; /* Entry i is at i % ROW_INDEX_BLOCK in blocks[i / ROW_INDEX_BLOCK] */
+	long long nblocks;
+	long long n;
+	unsigned char *hl_state; /* Lexer state at the end of every row, NULL until the rows are highlighted */
+	long long hl_cap;
+};
+
+/* Row index flags */
+#define ROW_INDEX_TABS 1 /* The row holds a tab, rows without one render as they are and start with a valid render */
+#define ROW_INDEX_CONVERTED 2 /* A save writes the row differently than the file holds it, see editorMarkConverted */
+
+/* A mapped file and the row index of its lines. Every buffer that opens the file while it is unchanged reads the same
+ * mapping and index, only the lexer states are kept by each buffer. */
+struct fileMap
+{
+	struct fileMap *next;
+	int refs; /* Buffers that use it, the mapping goes away with the last one */
+	char *map;
+	size_t size;
+	struct stat st; /* The file as it was mapped */
+	struct rowIndex index; /* hl_state isn't used, every buffer keeps its own */
+	int converted_lo, converted_hi; /* Rows a save writes differently than the file holds them */
+	int loading; /* The row index isn't complete yet, so the file isn't shared */
+};
+
+/* A file that is indexed on the loader thread while the rows indexed so far are shown and edited. The loader thread
+ * hands rows over a chunk at a time, the main thread adds them after the last row. */
+struct loadJob
+{
+	char *map;
+	size_t size;
+	int threaded;
+	pthread_t thread;
+	int cancel; /* Set by the main thread to stop the loader thread early */
+	/* Only the loader thread uses these until it ended */
+	struct rowIndexBlock *block; /* Block the next leaf goes into */
+	long long indexed; /* Rows indexed so far */
+	int converted_lo, converted_hi; /* Rows a save writes differently than the file holds them */
+	/* Guarded by lock */
+	pthread_mutex_t lock;
+	pthread_cond_t ready; /* Signaled when rows were handed over or the load ended */
+	struct rowIndexBlock **blocks; /* Every block made so far */
+	long long nblocks;
+	long long rows; /* Rows handed over, the entries of these in the blocks don't change any more */
+	int rows_converted_lo, rows_converted_hi; /* converted_lo and converted_hi when the rows were handed over */
+	size_t end; /* Byte of the file after the last row handed over */
+	int finished;
+	int error; /* errno of a failed load */
+	/* Only the main thread uses this */
+	size_t loaded; /* Bytes of the file that are rows, for the progress in the status bar */
+};
+
+/* The document is stored as a treap of leaves, every leaf holds up to ROW_LEAF_MAX consecutive rows.
+ * Each node knows how many rows its subtree holds, so rows are found, inserted and deleted by line number in O(log n). */
+#define ROW_LEAF_MAX 256
+
+typedef struct rowLeaf
+{
+	struct rowLeaf *left, *right; /* Children in the treap */
+	struct rowLeaf *prev, *next; /* Neighbouring leaves in document order, used for walking over all rows */
+	unsigned int priority;
+	int count; /* Number of rows in this subtree */
+	int n; /* Number of rows in this leaf */
+	long long first; /* Row index entry of the first row while rows is NULL */
+	editor_row *rows; /* Room for ROW_LEAF_MAX rows, NULL while the rows are only in the row index */
+} rowLeaf;
+
+/* How a save gets the document to disk */
+#define SAVE_FULL 0 /* Every row is written to a temporary file that replaces the original */
+#define SAVE_PREFIX 1 /* Like SAVE_FULL, but the unchanged start of the file is copied over from the original */
+#define SAVE_INPLACE 2 /* The document is as long as the file, the changed bytes fit in a page and are written over it */
+
+/* Block that edited rows are copied into for a save */
+struct saveChunk
+{
+	struct saveChunk *next;
+	size_t len, cap;
+	char data[];
+};
+
+/* Everything a save needs, so it can run on its own thread while the rows keep changing */
+struct saveJob
+{
+	char *target; /* File that is written */
+	int mode;
+	long long from; /* Byte offset where iov starts, the bytes before it stay as they are */
+	long long total; /* Length of the whole document */
+	struct iovec *iov; /* The rows from the first changed one on */
+	int iovcnt, iovcap;
+	struct saveChunk *chunks; /* Copies of the edited rows, unchanged rows point straight into the mapped file */
+	int dirty_flag, dirty_lo; /* What was dirty when the snapshot was taken */
+	int threaded;
+	pthread_t thread;
+	int done;
+	int error; /* errno of the failure, 0 after a successful save */
+	struct stat st; /* The file that was written */
+};
+
+/* Kinds of undo records, each one describes an edit by what it changed rather than by copies of the rows */
+#define UNDO_SPLICE 0 /* The text at y, x was replaced, del is what was taken out and ins what was put in */
+#define UNDO_SPLIT 1 /* Row y was broken in two at index x */
+#define UNDO_JOIN 2 /* Row y + 1 was appended to row y, which was x characters long */
+#define UNDO_INSERT_ROW 3 /* Row y was inserted holding ins */
+#define UNDO_DELETE_ROW 4 /* Row y was deleted while it held del */
+
+/* Block of the arena undo records are allocated from, records are only ever added or dropped at the end */
+struct undoBlock
+{
+	struct undoBlock *prev;
+	size_t used, cap;
+	char data[];
+};
+
+struct undoRecord
+{
+	struct undoRecord *prev, *next;
+	int type;
+	int group; /* Records made by one command are undone and redone together */
+	int y, x;
+	int dellen, inslen;
+	char text[]; /* The deleted characters followed by the inserted ones */
+};
+
+/* A batch of journal records that a thread appends to the journal file and syncs */
+struct journalBatch
+{
+	int fd;
+	char *buf;
+	size_t len;
+	int threaded;
+	pthread_t thread;
+	int done;
+	int error;
+};
+
+/* Edits since the file was opened or saved, written next to the file so they can be replayed after a crash */
+struct editJournal
+{
+	char *path; /* NULL while the document has no file */
+	int fd; /* -1 until the first batch is written */
+	char *buf; /* Records that aren't handed to a batch yet */
+	size_t len, cap;
+	char *carry; /* Records made while a save runs, the journal starts over with them once the save is done */
+	size_t carrylen, carrycap;
+	long long flushed; /* When the last batch was started */
+	struct journalBatch *batch; /* Batch that is being written, NULL when there is none */
+	int paused; /* Loading, replaying and the parts of a split or a join aren't journaled */
+	int resync; /* The header was written over since the last batch, which has to sync it */
+};
+
+struct undoJournal
+{
+	struct undoBlock *top; /* Block new records go into, the blocks before it are full */
+	struct undoRecord *first, *last;
+	struct undoRecord *current; /* Newest record that is applied, the ones after it can be redone */
+	int group; /* Group of the command that is running */
+	int paused; /* Edits made while undoing, redoing or loading a file aren't recorded */
+	size_t bytes; /* Memory held by the blocks */
+};
+
+/* Stages of handling a key that are timed */
+enum perfPhase
+{
+	PERF_DECODE = 0, /* Reading and decoding the key */
+	PERF_EDIT, /* Running the command bound to it */
+	PERF_SCROLL,
+	PERF_RENDER, /* Building the screen */
+	PERF_WRITE, /* Writing it to the terminal */
+	PERF_FRAME, /* All of a redraw */
+	PERF_ROWS, /* Drawing the text rows, part of PERF_RENDER */
+	PERF_ROW_UPDATE, /* Building the render of one row, part of PERF_ROWS */
+	PERF_SAVE, /* What a save keeps the main thread busy with */
+	PERF_PHASES
+};
+
+/* A timed span, the last SIMPLR_TRACE_EVENTS of them are kept for the trace */
+struct perfEvent
+{
+	int phase;
+	long long start, ns;
+};
+
+/* Durations in nanoseconds, bucket b counts the ones below 2^b */
+struct perfHistogram
+{
+	long long count, total, max;
+	long long buckets[SIMPLR_PERF_BUCKETS];
+};
+
+struct perfStats
+{
+	struct perfHistogram phase[PERF_PHASES];
+	long long frames;
+	long long bytes; /* Written to the terminal */
+	long long keys;
+	long long rows_rendered;
+	long long appends, append_bytes; /* Calls to abAppend and the bytes they added */
+	long long last_frame_ns, last_frame_bytes, last_frame_rows, last_key_ns; /* The newest frame and key, for the overlay */
+	struct perfEvent events[SIMPLR_TRACE_EVENTS];
+	unsigned int nevents; /* Events recorded so far, the ring holds the newest ones */
+};
+
+/* Keys a benchmark replays through the input ring instead of reading the terminal */
+struct benchKeys
+{
+	char *b;
+	size_t len, pos;
+};
+
+/* Following a file that grows, text appended to it becomes rows after the last one */
+struct editorFollow
+{
+	int active;
+	int fd; /* The followed file, read with pread so nothing else depends on its position */
+	int wd; /* inotify watch of the file */
+	long long offset; /* Bytes of the file that are rows already */
+	int partial; /* The last row didn't end in a newline yet, the next bytes continue it */
+	int more; /* The file may hold bytes after offset */
+	int gone; /* The file was moved or deleted, following stops once the rest of it is read */
+	unsigned int hash; /* Hash of the first hashed bytes of the file, only kept up while a journal needs it */
+	long long hashed;
+};
+
+/* A document that isn't shown. The shown one lives in conf, switching buffers swaps these fields with the ones
+ * in conf, so it takes the same time whatever the size of the documents. See editorConfig for what they hold. */
+struct editorBuffer
+{
+	int cx, cy;
+	int coloff;
+	int rx;
+	int rowoff;
+	int numrows;
+	rowLeaf *rows;
+	struct rowIndex index;
+	struct fileMap *file;
+	rowLeaf *rowcache;
+	int rowcache_base;
+	int render_lo, render_hi;
+	struct editorSyntax *syntax;
+	int hl_lo, hl_hi;
+	int dirty_flag;
+	int dirty_lo, dirty_hi;
+	char *filename;
+	char *map;
+	size_t mapsize;
+	dev_t map_dev;
+	ino_t map_ino;
+	struct stat filestat;
+	int filestat_valid;
+	struct saveJob *save;
+	struct undoJournal undo;
+	struct editJournal journal;
+	struct rowStore store;
+	struct editorFollow follow;
+	struct loadJob *load;
+};
+
 struct editorConfig
 {
 	int cx, cy; 
@@ -62,11 +441,47 @@ struct editorConfig
 	int screenrows;
 	int screencols;
 	int numrows;
-	editor_row *row;
+	rowLeaf *rows; /* Root of the row tree */
+	struct rowIndex index; /* Rows of the mapped file as it was loaded, the arrays other than hl_state belong to file */
+	struct fileMap *file; /* Mapped file the rows point into, NULL when there is none */
+	rowLeaf *rowcache; /* Leaf of the last looked up row, so walking nearby rows doesn't descend the tree every time */
+	int rowcache_base;
+	int render_lo, render_hi; /* Rows outside of this range don't hold render buffers */
+	struct editorSyntax *syntax; /* NULL when the file isn't highlighted */
+	int hl_lo, hl_hi; /* Rows from hl_lo on may not end in the state they store, past hl_hi only if a row before them changed state */
+	struct abuf *frame; /* What every screen line shows right now, only lines that change are written again */
+	int frame_rows; /* Number of lines in frame, 0 makes the next refresh clear and redraw the whole screen */
+	int frame_rowoff, frame_coloff; /* Scroll offsets the frame was drawn with */
 	int dirty_flag;
+	int dirty_lo, dirty_hi; /* Rows before dirty_lo and from dirty_hi on are the same as in the file on disk */
 	char *filename;
-	char status_message[80];
+	char *map; /* Read-only mapping of the opened file, rows point into it until they are edited */
+	size_t mapsize;
+	dev_t map_dev; /* The mapped file, rows pointing into it must not be written over it */
+	ino_t map_ino;
+	struct stat filestat; /* The file as it was after loading or the last save, the next save only writes what changed since */
+	int filestat_valid;
+	struct saveJob *save; /* Save that is running, NULL when there is none */
+	struct countJob *search; /* Matches of the search term being counted, NULL outside of a search */
+	struct undoJournal undo;
+	struct editJournal journal;
+	struct rowStore store; /* Memory of the rows */
+	struct loadJob *load; /* Loader thread that still indexes the file, NULL once all of it is rows */
+	struct editorBuffer *buffers; /* Every open buffer, the slot of the shown one holds nothing of use */
+	int nbuffers;
+	int buffer; /* The shown buffer */
+	struct fileMap *files; /* Mapped files of all buffers */
+	struct editorFollow follow;
+	int inotify; /* Tells when followed files change, -1 until a file is followed */
+	struct benchKeys *bench; /* NULL unless a benchmark script runs */
+	int perf_overlay; /* The message bar shows the perf counters instead of messages */
+	pthread_rwlock_t rowlock; /* Held for writing by the main thread except while it waits, workers read rows under it */
+	char status_message[160];
 	time_t status_message_time;
+	char input[SIMPLR_INPUT_SIZE]; /* Ring buffer of bytes read from the terminal that aren't decoded yet */
+	unsigned int input_head, input_tail; /* Read and write positions, they only grow and wrap around */
+	int wakefd[2]; /* Self-pipe, signal handlers and other wakeups write to it to interrupt the wait for input */
+	volatile sig_atomic_t winch; /* Set when the terminal window was resized */
 	struct termios original_termios;
 };
 
@@ -75,7 +490,123 @@ struct editorConfig conf;
 /* ====== PROTOTYPES ======*/
 void statusMessage(const char *fmt, ...);
 void clearScreen();
-char *editorPrompt(char *prompt);
+void editorFrameInvalidate();
+void editorResize();
+void editorSearchCountStop();
+char *editorPrompt(char *prompt, void (*callback)(char *, int));
+struct undoRecord *editorUndoRecord(int type, int y, int x, const char *del, int dellen, const char *ins, int inslen);
+void editorUndoReset();
+long long editorNowMs();
+void editorJournalWrite(int type, int y, int x, int remove, const char *ins, int inslen);
+void editorJournalOpen();
+void editorJournalFlush(int block);
+void editorJournalFollowed();
+unsigned int editorFollowHash();
+void editorJournalSaved(int ok);
+void editorSelectSyntax();
+void editorFollowEvents();
+void editorFollowStop();
+void editorInitLock();
+void initEditor();
+
+/* ====== PERF ======*/
+/* Counters that are always on, a clock read costs a few tens of nanoseconds next to the microseconds a key takes */
+struct perfStats perf;
+
+long long perfNowNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void perfHistogramAdd(struct perfHistogram *h, long long ns)
+{
+	int b = ns > 0 ? 64 - __builtin_clzll(ns) : 0;
+	if(b >= SIMPLR_PERF_BUCKETS)
+	{
+		b = SIMPLR_PERF_BUCKETS - 1;
+	}
+	h->buckets[b]++;
+	h->count++;
+	h->total += ns;
+	if(ns > h->max)
+	{
+		h->max = ns;
+	}
+}
+
+/* Counting the time since start for a phase, returns the current time so phases can be timed one after another */
+long long perfRecord(int phase, long long start)
+{
+	long long now = perfNowNs();
+	perfHistogramAdd(&perf.phase[phase], now - start);
+	struct perfEvent *e = &perf.events[perf.nevents++ & (SIMPLR_TRACE_EVENTS - 1)];
+	e->phase = phase;
+	e->start = start;
+	e->ns = now - start;
+	return now;
+}
+
+/* Upper bound of the duration below which the given share of a histogram falls */
+long long perfPercentile(struct perfHistogram *h, double share)
+{
+	long long want = h->count * share;
+	long long seen = 0;
+	int b;
+	for(b = 0; b < SIMPLR_PERF_BUCKETS - 1; b++)
+	{
+		seen += h->buckets[b];
+		if(seen > want)
+		{
+			return 1LL << b < h->max ? 1LL << b : h->max;
+		}
+	}
+	return h->max;
+}
+
+const char *perfPhaseNames[PERF_PHASES] = {"decode", "edit", "scroll", "render", "write", "frame", "rows", "rowupdate", "save"};
+
+/* Bytes the heap holds for the editor, as mallinfo2 reports them */
+long long perfHeapBytes()
+{
+	struct mallinfo2 mi = mallinfo2();
+	return mi.uordblks + mi.hblkhd;
+}
+
+/* Writing the counters and the newest timed spans to the file SIMPLR_TRACE names, in the Chrome trace format that
+ * chrome://tracing and Perfetto open. Registered with atexit when the variable is set. */
+void perfWriteTrace()
+{
+	FILE *f = fopen(getenv("SIMPLR_TRACE"), "w");
+	if(f == NULL)
+	{
+		return;
+	}
+	unsigned int first = perf.nevents > SIMPLR_TRACE_EVENTS ? perf.nevents - SIMPLR_TRACE_EVENTS : 0;
+	unsigned int i;
+	int j;
+	fprintf(f, "{\"traceEvents\":[");
+	for(i = first; i != perf.nevents; i++)
+	{
+		struct perfEvent *e = &perf.events[i & (SIMPLR_TRACE_EVENTS - 1)];
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+				i == first ? "" : ",", perfPhaseNames[e->phase], e->start / 1000.0, e->ns / 1000.0);
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\n\"counters\":{\"frames\":%lld,\"bytes_written\":%lld,\"keys\":%lld,"
+			"\"rows_rendered\":%lld,\"appends\":%lld,\"append_bytes\":%lld,\"heap_bytes\":%lld,"
+			"\"row_store_used\":%lld,\"row_store_slab_bytes\":%lld,\"row_store_large_blocks\":%lld,\"row_store_large_bytes\":%lld},\n\"phases\":{",
+			perf.frames, perf.bytes, perf.keys, perf.rows_rendered, perf.appends, perf.append_bytes, perfHeapBytes(),
+			conf.store.used, conf.store.slab_bytes, conf.store.large_blocks, conf.store.large_bytes);
+	for(j = 0; j < PERF_PHASES; j++)
+	{
+		struct perfHistogram *h = &perf.phase[j];
+		fprintf(f, "%s\n\"%s\":{\"count\":%lld,\"total_ns\":%lld,\"max_ns\":%lld,\"p50_ns\":%lld,\"p99_ns\":%lld}",
+				j == 0 ? "" : ",", perfPhaseNames[j], h->count, h->total, h->max, perfPercentile(h, 0.5), perfPercentile(h, 0.99));
+	}
+	fprintf(f, "\n}}\n");
+	fclose(f);
+}
 
 /* Function to output all errors that occurr*/
 void errorHandling(const char *s)
@@ -90,6 +621,7 @@ void errorHandling(const char *s)
 /*Function to restore users original terminal attributes at exit*/
 void disableRawMode()
 {
+	write(STDOUT_FILENO, "\x1b[?2004l", 8); /* Turning bracketed paste off again */
 	if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &conf.original_termios) == -1)
 	{
 		errorHandling("tcsetattr");
@@ -113,46 +645,186 @@ void enableRawMode()
 	rawmode.c_cflag |= (CS8);
 	/*Disabling canonical/cooked mode(reading input byte-by-byte instead of line-by-line) and CTRL+Z/CTRL+C as they can terminate the editor or suspend it to background*/
 	rawmode.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-	/*Setting a timeout for read function*/
+	/*Reads never block, waiting for input is done with poll*/
 	rawmode.c_cc[VMIN] = 0;
-  	rawmode.c_cc[VTIME] = 1;
+  	rawmode.c_cc[VTIME] = 0;
 	/*Setting terminal parameters using tcsetattr() into termios struct*/
 	if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &rawmode) == -1)
 	{
 		errorHandling("tcsetattr");
 	}
+	/* Asking the terminal to mark pasted text, so a paste is inserted at once instead of key by key */
+	write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-/*Function for listening for one keypress and returning it*/
-int editorReadKey()
+/* Reading as much as the terminal has sent into the input ring, returns the number of new bytes */
+int editorInputFill()
 {
+	unsigned int used = conf.input_tail - conf.input_head;
+	unsigned int at = conf.input_tail & (SIMPLR_INPUT_SIZE - 1);
+	unsigned int room = SIMPLR_INPUT_SIZE - used;
+	if(room > SIMPLR_INPUT_SIZE - at)
+	{
+		room = SIMPLR_INPUT_SIZE - at;
+	}
+	if(room == 0)
+	{
+		return 0;
+	}
 	int nread;
+	if(conf.bench)
+	{
+		/* A benchmark replays its keys from memory */
+		struct benchKeys *keys = conf.bench;
+		nread = keys->len - keys->pos < room ? keys->len - keys->pos : room;
+		memcpy(&conf.input[at], &keys->b[keys->pos], nread);
+		keys->pos += nread;
+	}else
+	{
+		nread = read(STDIN_FILENO, &conf.input[at], room);
+	}
+	if(nread == -1 && errno != EAGAIN && errno != EINTR)
+	{
+		errorHandling("read");
+	}
+	if(nread <= 0)
+	{
+		return 0;
+	}
+	conf.input_tail += nread;
+	return nread;
+}
+
+/* Interrupting editorWaitEvent, safe to call from signal handlers */
+void editorWake()
+{
+	int saved_errno = errno;
+	write(conf.wakefd[1], "", 1);
+	errno = saved_errno;
+}
+
+void editorHandleWinch(int sig)
+{
+	(void)sig;
+	conf.winch = 1;
+	editorWake();
+}
+
+/* Creating the wake pipe and the signal handlers that use it */
+void editorInitEvents()
+{
+	if(pipe(conf.wakefd) == -1)
+	{
+		errorHandling("pipe");
+	}
+	fcntl(conf.wakefd[0], F_SETFL, O_NONBLOCK);
+	fcntl(conf.wakefd[1], F_SETFL, O_NONBLOCK);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = editorHandleWinch;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGWINCH, &sa, NULL);
+}
+
+/* Sleeping until the terminal sends something, the wake pipe is written to, a followed file changes or timeout
+ * milliseconds pass (-1 waits forever). Returns 1 if there is input to read. */
+int editorWaitEvent(int timeout)
+{
+	struct pollfd pfd[3] = {{STDIN_FILENO, POLLIN, 0}, {conf.wakefd[0], POLLIN, 0}, {conf.inotify, POLLIN, 0}};
+	/* Workers can read the rows while the main thread sleeps */
+	pthread_rwlock_unlock(&conf.rowlock);
+	int n = poll(pfd, conf.inotify == -1 ? 2 : 3, timeout);
+	pthread_rwlock_wrlock(&conf.rowlock);
+	if(n == -1)
+	{
+		if(errno != EINTR)
+		{
+			errorHandling("poll");
+		}
+		return 0;
+	}
+	if(pfd[1].revents & POLLIN)
+	{
+		char buf[64];
+		while(read(conf.wakefd[0], buf, sizeof(buf)) > 0)
+		{
+		}
+	}
+	if(conf.inotify != -1 && (pfd[2].revents & POLLIN))
+	{
+		editorFollowEvents();
+	}
+	if(pfd[0].revents & (POLLHUP | POLLERR))
+	{
+		/* The terminal went away, for example the ssh session dropped */
+		errno = EIO;
+		errorHandling("read");
+	}
+	return (pfd[0].revents & POLLIN) != 0;
+}
+
+/* Taking the next input byte, waiting up to timeout milliseconds for it. Returns 0 if none arrived. */
+int editorInputByte(char *c, int timeout)
+{
+	if(conf.input_head == conf.input_tail && editorInputFill() == 0)
+	{
+		struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+		if(timeout == 0 || conf.bench || poll(&pfd, 1, timeout) <= 0 || editorInputFill() == 0)
+		{
+			return 0;
+		}
+	}
+	*c = conf.input[conf.input_head++ & (SIMPLR_INPUT_SIZE - 1)];
+	return 1;
+}
+
+/* Checking if more keys are waiting, either bytes in the ring or unread bytes in the terminal */
+int editorInputPending()
+{
+	if(conf.input_head != conf.input_tail)
+	{
+		return 1;
+	}
+	struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+	return poll(&pfd, 1, 0) > 0;
+}
+
+int editorReadKey()
+{
 	char c; 
-	while((nread = read(STDIN_FILENO, &c, 1)) != 1)
+	while(!editorInputByte(&c, 0))
 	{
-		if(nread == -1 && errno != EAGAIN)
+		if(conf.bench)
+		{
+			fprintf(stderr, "bench: the script ran out of keys while a prompt waited for more\n");
+			exit(1);
+		}
+		editorWaitEvent(-1);
+		if(conf.winch)
 		{
-			errorHandling("read");
+			editorResize();
 		}
+		/* Prompts wait here for keys, so a resize or results of the workers are drawn right away */
+		clearScreen();
 	}
 	/*Reading arrow keys and modifying the function to read escape chars as single keypresses*/
 	/*Here the program is handling ESCAPE sequences such as PAGE_UP/DOWN or HOME/END*/
 	if(c == '\x1b')
 	{
-		char sequence[3];
+		char sequence[5];
 
-		if(read(STDIN_FILENO, &sequence[0], 1) != 1)
+		if(!editorInputByte(&sequence[0], SIMPLR_ESC_TIMEOUT))
 		{
 			return '\x1b';
 		}
-		if(read(STDIN_FILENO, &sequence[1], 1) != 1)
+		if(!editorInputByte(&sequence[1], SIMPLR_ESC_TIMEOUT))
 		{
 			return '\x1b';
 		}
 		if(sequence[0] == '[')
 		{
 			if (sequence[1] >= '0' && sequence[1] <= '9') {
-        			if (read(STDIN_FILENO, &sequence[2], 1) != 1) return '\x1b';
+        			if (!editorInputByte(&sequence[2], SIMPLR_ESC_TIMEOUT)) return '\x1b';
         			if (sequence[2] == '~') {
           				switch (sequence[1]) {
 						case '1': 
@@ -170,7 +842,13 @@ int editorReadKey()
 						case '8': 
 							return END;
           				}
-        		}
+        			}else if(sequence[1] == '2' && sequence[2] == '0')
+				{
+					/* Bracketed paste markers are ESC[200~ and ESC[201~ */
+					if(!editorInputByte(&sequence[3], SIMPLR_ESC_TIMEOUT) || !editorInputByte(&sequence[4], SIMPLR_ESC_TIMEOUT)) return '\x1b';
+					if(sequence[4] == '~' && sequence[3] == '0') return PASTE_START;
+					if(sequence[4] == '~' && sequence[3] == '1') return PASTE_END;
+				}
       			}else
 		       	{
 				switch(sequence[1])
@@ -216,7 +894,7 @@ int getCursorPosition(int *rows, int *cols)
 	}
 	while(i < sizeof(buf) - 1)
 	{
-		if(read(STDIN_FILENO, &buf[i], 1) != 1)
+		if(!editorInputByte(&buf[i], SIMPLR_ESC_TIMEOUT))
 		{
 			break; 
 		}
@@ -245,7 +923,7 @@ int getWindowSize(int *rows, int *cols)
 
 	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) 
 	{
-		if(write(STDOUT_FILENO, "\x1b[999C\x1n[999B", 12) != 12)
+		if(write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
 		{
 			return -1; 
 		}
@@ -258,459 +936,6012 @@ int getWindowSize(int *rows, int *cols)
 	}
 }
 
-/* ====== ROW OPERATIONS ======*/
+/* Picking up the new terminal size after SIGWINCH.
+ * Renders don't depend on the window size, so nothing but the frame has to be drawn again,
+ * and editorScroll brings rowoff and coloff back around the cursor on the next refresh. */
+void editorResize()
+{
+	int rows, cols;
+	conf.winch = 0;
+	if(getWindowSize(&rows, &cols) == -1)
+	{
+		return;
+	}
+	rows -= 2; /* Leaving room for the status and message bars */
+	if(rows < 1)
+	{
+		rows = 1;
+	}
+	if(rows == conf.screenrows && cols == conf.screencols)
+	{
+		return;
+	}
+	conf.screenrows = rows;
+	conf.screencols = cols;
+	/* The terminal reflows its contents on a resize, so what the frame remembers is no longer on screen */
+	editorFrameInvalidate();
+}
 
-/* Converting cx to rx to find out how many columns the user's cursor is to the left of the next tab stop(4) */
-int editorRowCxToRx(editor_row *row, int cx)
+/* ====== SCAN KERNELS ======*/
+/* Loops over every byte of a file or a row. Each one has a scalar version and, on x86, SSE2 and AVX2 versions,
+ * editorScanInit points the kernels at the widest ones the processor supports. */
+
+/* Finding up to max newlines in s and storing their offsets in ends. Fewer than max means all of s was scanned. */
+int scanNewlinesScalar(const char *s, size_t len, size_t *ends, int max)
 {
-	int rx = 0;
+	int n = 0;
+	const char *p = s;
+	const char *end = s + len;
+	while(n < max && (p = memchr(p, '\n', end - p)) != NULL)
+	{
+		ends[n++] = p++ - s;
+	}
+	return n;
+}
+
+/* Counting how many times c occurs in s */
+int scanCountScalar(const char *s, int len, char c)
+{
+	int n = 0;
 	int j;
-	for(j = 0; j < cx; j++)
+	for(j = 0; j < len; j++)
 	{
-		if(row->chars[j] == '\t')
-			rx += (SIMPLR_TAB_STOP - 1) - (rx % SIMPLR_TAB_STOP);
-		rx++;
+		n += s[j] == c;
 	}
-	return rx;
+	return n;
 }
 
-void editorRowUpdate(editor_row *row)
+/* Finding the first (scanFind) or the last (scanFindLast) place the n byte needle occurs in s.
+ * The vector versions compare the first and the last byte of the needle at every position of a block at once,
+ * and only the positions where both agree are compared in full, shorter needles are left to the scalar versions. */
+const char *scanFindScalar(const char *s, size_t len, const char *needle, size_t n)
+{
+	return memmem(s, len, needle, n);
+}
+
+const char *scanFindLastScalar(const char *s, size_t len, const char *needle, size_t n)
 {
-	int tabs = 0;
-	int j; 
-	for(j = 0; j < row->size; j++)
+	if(n == 0)
 	{
-		if(row->chars[j] == '\t') tabs++;
+		return s + len;
 	}
-	free(row->render);
-	row->render = malloc(row->size + tabs*(SIMPLR_TAB_STOP -1) + 1);
-	int idx = 0;
-	for(j= 0; j < row->size; j++)
+	size_t i;
+	for(i = len >= n ? len - n + 1 : 0; i > 0; i--)
 	{
-		if(row->chars[j] == '\t')
+		if(s[i - 1] == needle[0] && memcmp(s + i, needle + 1, n - 1) == 0)
 		{
-			row->render[idx++] = row->chars[j];
-			while(idx % 8 != 0)
-			{
-				row->render[idx++] = ' ';
-			}
-			while (idx % SIMPLR_TAB_STOP != 0)
+			return s + i - 1;
+		}
+	}
+	return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* The vector versions compare a whole block at once and walk the bits of the match mask,
+ * so short lines don't pay for a call per line */
+__attribute__((target("sse2")))
+int scanNewlinesSSE2(const char *s, size_t len, size_t *ends, int max)
+{
+	__m128i nl = _mm_set1_epi8('\n');
+	int n = 0;
+	size_t i;
+	for(i = 0; i + 16 <= len; i += 16)
+	{
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), nl));
+		while(mask)
+		{
+			if(n == max)
 			{
-				row->render[idx++] = ' ';
+				return n;
 			}
-		}else
+			ends[n++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+	/* The bytes after the last whole block */
+	for(; i < len && n < max; i++)
+	{
+		if(s[i] == '\n')
 		{
-			row->render[idx++] = row->chars[j];
+			ends[n++] = i;
 		}
 	}
-	row->render[idx] = '\0';
-	row->rsize = idx;
+	return n;
 }
 
-void editorInsertRow(int at, char *s, size_t len)
+__attribute__((target("avx2")))
+int scanNewlinesAVX2(const char *s, size_t len, size_t *ends, int max)
 {
-	if(at < 0 || at > conf.numrows)
+	__m256i nl = _mm256_set1_epi8('\n');
+	int n = 0;
+	size_t i;
+	for(i = 0; i + 32 <= len; i += 32)
 	{
-		return; 
+		unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), nl));
+		while(mask)
+		{
+			if(n == max)
+			{
+				return n;
+			}
+			ends[n++] = i + __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
 	}
-	conf.row = realloc(conf.row, sizeof(editor_row) * (conf.numrows + 1));
-	memmove(&conf.row[at + 1], &conf.row[at], sizeof(editor_row) * (conf.numrows - at));
-	conf.row[at].size = len;
-	conf.row[at].chars = malloc(len + 1);
-	memcpy(conf.row[at].chars, s, len);
-	conf.row[at].chars[len] = '\0';
-
-	conf.row[at].rsize = 0;	
-	conf.row[at].render = NULL;
-	editorRowUpdate(&conf.row[at]);
-	conf.numrows++;
-	conf.dirty_flag++; 
-}
-/* Function for freeing memory held by editor_row that we are deleting */
-void editorFreeRow(editor_row *row)
-{
-	free(row->render);
-	free(row->chars);
+	/* The bytes after the last whole block */
+	for(; i < len && n < max; i++)
+	{
+		if(s[i] == '\n')
+		{
+			ends[n++] = i;
+		}
+	}
+	return n;
 }
-/* Deleting a single element from an array of elements by it's index */
-void editorDeleteRow(int at)
+
+__attribute__((target("sse2")))
+int scanCountSSE2(const char *s, int len, char c)
 {
-	if(at < 0 || at >= conf.numrows)
+	__m128i v = _mm_set1_epi8(c);
+	int n = 0;
+	int j;
+	for(j = 0; j + 16 <= len; j += 16)
 	{
-		return;
+		n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + j)), v)));
 	}
-	editorFreeRow(&conf.row[at]);
-	memmove(&conf.row[at], &conf.row[at + 1], sizeof(editor_row) * (conf.numrows - at - 1)); /* Overwriting the deleted row */
-	conf.numrows--;
-	conf.dirty_flag++;
+	return n + scanCountScalar(s + j, len - j, c);
 }
 
-void editorRowInsertChar(editor_row *row, int at, int c)
+__attribute__((target("avx2,popcnt")))
+int scanCountAVX2(const char *s, int len, char c)
 {
-	if(at < 0 || at > row->size)
+	__m256i v = _mm256_set1_epi8(c);
+	int n = 0;
+	int j;
+	for(j = 0; j + 32 <= len; j += 32)
 	{
-		at = row->size;
+		n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + j)), v)));
 	}
-	row->chars = realloc(row->chars, row->size + 2);
-	memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-	row->size++;
-	row->chars[at] = c;
-	editorRowUpdate(row);
-	conf.dirty_flag++;
+	return n + scanCountScalar(s + j, len - j, c);
 }
 
-/* Function for appending a string to the end of the row */
-void editorRowAppendString(editor_row *row, char *s, size_t len)
+__attribute__((target("sse2")))
+const char *scanFindSSE2(const char *s, size_t len, const char *needle, size_t n)
 {
-	row->chars = realloc(row->chars, row->size + len + 1);
-	memcpy(&row->chars[row->size], s, len);
-  	row->size += len;
-  	row->chars[row->size] = '\0';
-  	editorRowUpdate(row);
-  	conf.dirty_flag++;
+	if(n < 2)
+	{
+		return scanFindScalar(s, len, needle, n);
+	}
+	if(n > len)
+	{
+		return NULL;
+	}
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[n - 1]);
+	size_t i;
+	for(i = 0; i + n - 1 + 16 <= len; i += 16)
+	{
+		__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), first);
+		__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + n - 1)), last);
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+		while(mask)
+		{
+			int bit = __builtin_ctz(mask);
+			if(memcmp(s + i + bit + 1, needle + 1, n - 2) == 0)
+			{
+				return s + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return scanFindScalar(s + i, len - i, needle, n);
 }
-void editorRowDeleteChar(editor_row *row, int at)
+
+__attribute__((target("avx2")))
+const char *scanFindAVX2(const char *s, size_t len, const char *needle, size_t n)
 {
-	if(at < 0 || at >= row->size)
+	if(n < 2)
 	{
-		return; 
+		return scanFindScalar(s, len, needle, n);
 	}
-	memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-	row->size--;
-	editorRowUpdate(row);
-	conf.dirty_flag++;	
+	if(n > len)
+	{
+		return NULL;
+	}
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[n - 1]);
+	size_t i;
+	for(i = 0; i + n - 1 + 32 <= len; i += 32)
+	{
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), first);
+		__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + n - 1)), last);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+		while(mask)
+		{
+			int bit = __builtin_ctz(mask);
+			if(memcmp(s + i + bit + 1, needle + 1, n - 2) == 0)
+			{
+				return s + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return scanFindScalar(s + i, len - i, needle, n);
 }
 
-/* ====== FILE INPUT/OUTPUT ======*/
-char *rowsToString(int *buflen)
-{
-	int totlen = 0; 
-	int j; 
-	for(j = 0; j < conf.numrows; j++)
-		totlen += conf.row[j].size + 1;
-	*buflen = totlen;
-	char *buf = malloc(totlen);
-	char *p = buf; 
-	for(j = 0; j < conf.numrows; j++)
-	{
-		memcpy(p, conf.row[j].chars, conf.row[j].size);
-		p += conf.row[j].size;
-		*p  = '\n';
-		p++;
+/* The backward versions walk the blocks from the end and the mask bits from the highest */
+__attribute__((target("sse2")))
+const char *scanFindLastSSE2(const char *s, size_t len, const char *needle, size_t n)
+{
+	if(n < 2)
+	{
+		return scanFindLastScalar(s, len, needle, n);
+	}
+	if(n > len)
+	{
+		return NULL;
+	}
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[n - 1]);
+	size_t i = len - n + 1; /* Positions a match can start at */
+	while(i >= 16)
+	{
+		i -= 16;
+		__m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), first);
+		__m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + n - 1)), last);
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(a, b));
+		while(mask)
+		{
+			int bit = 31 - __builtin_clz(mask);
+			if(memcmp(s + i + bit + 1, needle + 1, n - 2) == 0)
+			{
+				return s + i + bit;
+			}
+			mask &= ~(1u << bit);
+		}
 	}
-	return buf; 
+	return scanFindLastScalar(s, i + n - 1, needle, n);
 }
 
-/* Function for opening and reading given files */
-void editorOpen(char *filename)
+__attribute__((target("avx2")))
+const char *scanFindLastAVX2(const char *s, size_t len, const char *needle, size_t n)
 {
-	free(conf.filename);
-	conf.filename = strdup(filename);
+	if(n < 2)
+	{
+		return scanFindLastScalar(s, len, needle, n);
+	}
+	if(n > len)
+	{
+		return NULL;
+	}
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[n - 1]);
+	size_t i = len - n + 1;
+	while(i >= 32)
+	{
+		i -= 32;
+		__m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), first);
+		__m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + n - 1)), last);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+		while(mask)
+		{
+			int bit = 31 - __builtin_clz(mask);
+			if(memcmp(s + i + bit + 1, needle + 1, n - 2) == 0)
+			{
+				return s + i + bit;
+			}
+			mask &= ~(1u << bit);
+		}
+	}
+	return scanFindLastScalar(s, i + n - 1, needle, n);
+}
+#endif
 
-	FILE *file = fopen(filename, "r"); /* Opening given file */
-	if(file == NULL)
+int (*scanNewlines)(const char *s, size_t len, size_t *ends, int max) = scanNewlinesScalar;
+int (*scanCount)(const char *s, int len, char c) = scanCountScalar;
+const char *(*scanFind)(const char *s, size_t len, const char *needle, size_t n) = scanFindScalar;
+const char *(*scanFindLast)(const char *s, size_t len, const char *needle, size_t n) = scanFindLastScalar;
+
+void editorScanInit()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		scanNewlines = scanNewlinesAVX2;
+		scanCount = scanCountAVX2;
+		scanFind = scanFindAVX2;
+		scanFindLast = scanFindLastAVX2;
+	}else if(__builtin_cpu_supports("sse2"))
 	{
-		errorHandling("fopen");
+		scanNewlines = scanNewlinesSSE2;
+		scanCount = scanCountSSE2;
+		scanFind = scanFindSSE2;
+		scanFindLast = scanFindLastSSE2;
 	}
-	char *line = NULL; /* NULL is passed to line variable so it allocates brand new memory for every next line it reads */
-	size_t linecap = 0; 
-	ssize_t linelen;
-	/* Using while loops and conditions we can output multiple lines of text from user's file */
-	while ((linelen = getline(&line, &linecap, file)) != -1) {
-	    while (linelen > 0 && (line[linelen - 1] == '\n' ||
-        	                   line[linelen - 1] == '\r'))
-      		linelen--;
-    		editorInsertRow(conf.numrows, line, linelen);
-	
+#endif
+}
+
+/* ====== ROW STORE ======*/
+const int rowStoreSizes[ROW_STORE_CLASSES] = {8, 16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048};
+
+/* Finding the smallest class that fits n bytes, -1 if none does */
+int rowStoreClass(long long n)
+{
+	int c;
+	if(n > rowStoreSizes[ROW_STORE_CLASSES - 1])
+	{
+		return -1;
 	}
-  	free(line);
-  	fclose(file);
-  	conf.dirty_flag = 0;
+	for(c = 0; rowStoreSizes[c] < n; c++)
+	{
+	}
+	return c;
 }
 
-/* Saving changes the user made*/
-void saveChanges()
+/* Allocating a block of at least n bytes, cap is set to what the block really holds. The block is freed with
+ * rowStoreFree and either n or cap. */
+void *rowStoreAlloc(struct rowStore *store, long long n, int *cap)
 {
-	/* If user opens a new file conf.filename will be NULL, we will output a prompt to user if that happens */
-	if(conf.filename == NULL)
+	int c = rowStoreClass(n);
+	if(c == -1)
 	{
-		conf.filename = editorPrompt("Save file as(ESC = cancel): %s");
-		/* If user pressed ESC, we output that save command was aborted*/
-		if(conf.filename == NULL)
+		struct rowLarge *large = malloc(sizeof(struct rowLarge) + n);
+		large->size = n;
+		large->prev = NULL;
+		large->next = store->large;
+		if(store->large)
 		{
-			statusMessage("Save canceled.");
-			return;
+			store->large->prev = large;
 		}
+		store->large = large;
+		store->large_blocks++;
+		store->large_bytes += n;
+		store->used += n;
+		if(cap)
+		{
+			*cap = n;
+		}
+		return large + 1;
 	}
-	int len; 
-	char *buf = rowsToString(&len);
-	int fd = open(conf.filename, O_RDWR | O_CREAT, 0644); /* Opening file for reading and writing with standard permissions*/
-	if(fd != -1)
+	int size = rowStoreSizes[c];
+	void *p = store->free[c];
+	if(p)
+	{
+		store->free[c] = *(void **)p;
+	}else
 	{
-		if(ftruncate(fd, len) != -1)
+		if(store->bumpend - store->bump < size)
 		{
-			if(write(fd, buf, len) == len)
-			{
-				close(fd); /* Closing the file*/
-				free(buf); /* Freeing memory*/
-				conf.dirty_flag = 0;
-				statusMessage("Changes written to disk(%d bytes)", len);
-				return;
-			}
+			/* The rest of the slab is too small and is left unused */
+			struct rowSlab *slab = malloc(SIMPLR_SLAB_SIZE);
+			slab->next = store->slabs;
+			store->slabs = slab;
+			store->bump = slab->data;
+			store->bumpend = (char *)slab + SIMPLR_SLAB_SIZE;
+			store->slab_bytes += SIMPLR_SLAB_SIZE;
 		}
-		close(fd);
+		p = store->bump;
+		store->bump += size;
 	}
-	free(buf);
-	statusMessage("Couldn't save changes to disk. Error: %s", strerror(errno));
+	store->blocks[c]++;
+	store->used += size;
+	if(cap)
+	{
+		*cap = size;
+	}
+	return p;
 }
 
-/* ====== BUFFER APPEND ======*/
-struct abuf
+void rowStoreFree(struct rowStore *store, void *p, long long n)
 {
-	char *b;
-	int len;
-};
-#define ABUF_INIT {NULL, 0}
+	if(p == NULL)
+	{
+		return;
+	}
+	int c = rowStoreClass(n);
+	if(c == -1)
+	{
+		struct rowLarge *large = (struct rowLarge *)p - 1;
+		if(large->prev)
+		{
+			large->prev->next = large->next;
+		}else
+		{
+			store->large = large->next;
+		}
+		if(large->next)
+		{
+			large->next->prev = large->prev;
+		}
+		store->large_blocks--;
+		store->large_bytes -= large->size;
+		store->used -= large->size;
+		free(large);
+		return;
+	}
+	*(void **)p = store->free[c];
+	store->free[c] = p;
+	store->blocks[c]--;
+	store->used -= rowStoreSizes[c];
+}
 
-void abAppend(struct abuf *ab, const char *s, int len)
+/* Freeing every block of a store at once, for when the rows it holds are dropped together */
+void rowStoreRelease(struct rowStore *store)
+{
+	while(store->slabs)
+	{
+		struct rowSlab *next = store->slabs->next;
+		free(store->slabs);
+		store->slabs = next;
+	}
+	while(store->large)
+	{
+		struct rowLarge *next = store->large->next;
+		free(store->large);
+		store->large = next;
+	}
+	memset(store, 0, sizeof(*store));
+}
+
+/* ====== ROW TREE ======*/
+unsigned int rowTreeRandom()
+{
+	static unsigned int state = 2463534242u;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+int rowTreeCount(rowLeaf *t)
+{
+	return t ? t->count : 0;
+}
+
+void rowTreeRecount(rowLeaf *t)
+{
+	t->count = rowTreeCount(t->left) + t->n + rowTreeCount(t->right);
+}
+
+/* A leaf with room for rows of its own, or with first set one whose rows start at that row index entry */
+rowLeaf *rowTreeNewLeaf(long long first)
+{
+	rowLeaf *leaf = malloc(sizeof(rowLeaf));
+	leaf->left = leaf->right = NULL;
+	leaf->prev = leaf->next = NULL;
+	leaf->priority = rowTreeRandom();
+	leaf->count = 0;
+	leaf->n = 0;
+	leaf->first = first;
+	leaf->rows = first == -1 ? malloc(sizeof(editor_row) * ROW_LEAF_MAX) : NULL;
+	return leaf;
+}
+
+void rowTreeFreeLeaf(rowLeaf *leaf)
+{
+	free(leaf->rows);
+	free(leaf);
+}
+
+/* Joining two trees, every row of a comes before every row of b */
+rowLeaf *rowTreeMerge(rowLeaf *a, rowLeaf *b)
 {
-	char *new = realloc(ab->b, ab->len + len);
+	if(a == NULL)
+	{
+		return b;
+	}
+	if(b == NULL)
+	{
+		return a;
+	}
+	if(a->priority > b->priority)
+	{
+		a->right = rowTreeMerge(a->right, b);
+		rowTreeRecount(a);
+		return a;
+	}
+	b->left = rowTreeMerge(a, b->left);
+	rowTreeRecount(b);
+	return b;
+}
 
-	if(new == NULL)
+/* Splitting a tree so the first k rows end up in a and the rest in b, k has to fall on a leaf boundary */
+void rowTreeSplit(rowLeaf *t, int k, rowLeaf **a, rowLeaf **b)
+{
+	if(t == NULL)
 	{
+		*a = *b = NULL;
 		return;
 	}
-	memcpy(&new[ab->len], s, len);
-	ab->b = new;
-	ab->len += len;
+	int leftcount = rowTreeCount(t->left);
+	if(k <= leftcount)
+	{
+		rowTreeSplit(t->left, k, a, &t->left);
+		rowTreeRecount(t);
+		*b = t;
+	}else
+	{
+		rowTreeSplit(t->right, k - leftcount - t->n, &t->right, b);
+		rowTreeRecount(t);
+		*a = t;
+	}
 }
 
-void abFree(struct abuf *ab)
+/* Finding the leaf that holds row at and the line number of its first row, counts on the way are changed by delta */
+rowLeaf *rowTreeDescend(int at, int *base, int delta)
 {
-	free(ab->b);
+	rowLeaf *t = conf.rows;
+	int b = 0;
+	while(t)
+	{
+		if(delta)
+		{
+			t->count += delta; /* Without a change the tree is only read, so workers can look rows up too */
+		}
+		int leftcount = rowTreeCount(t->left);
+		if(at < b + leftcount)
+		{
+			t = t->left;
+		}else if(at < b + leftcount + t->n)
+		{
+			*base = b + leftcount;
+			return t;
+		}else
+		{
+			b += leftcount + t->n;
+			t = t->right;
+		}
+	}
+	return NULL;
 }
 
-/* ====== EDITOR OPERATIONS ======*/
-void editorInsertChar(int c)
+rowLeaf *rowTreeFirst()
 {
-	if(conf.cy  == conf.numrows)
+	rowLeaf *t = conf.rows;
+	while(t && t->left)
 	{
-		editorInsertRow(conf.numrows, "", 0);
+		t = t->left;
 	}
-	editorRowInsertChar(&conf.row[conf.cy], conf.cx, c);
-	conf.cx++;
+	return t;
 }
 
-void editorNewLine()
+rowLeaf *rowTreeLast()
 {
-	if(conf.cx == 0)
+	rowLeaf *t = conf.rows;
+	while(t && t->right)
 	{
-		editorInsertRow(conf.cy, "", 0);
-	}else
+		t = t->right;
+	}
+	return t;
+}
+
+/* Adding a filled leaf after the last row, used when loading files */
+void rowTreeAppendLeaf(rowLeaf *leaf)
+{
+	rowLeaf *last = rowTreeLast();
+	leaf->prev = last;
+	leaf->next = NULL;
+	if(last)
 	{
-		editor_row *row = &conf.row[conf.cy];
-		editorInsertRow(conf.cy + 1, &row->chars[conf.cx], row->size - conf.cx);
-		row = &conf.row[conf.cy];
-		row->size = conf.cx;
-		row->chars[row->size] = '\0';
-		editorRowUpdate(row);
+		last->next = leaf;
 	}
-	conf.cy++;
-	conf.cx = 0;
+	leaf->count = leaf->n;
+	conf.rows = rowTreeMerge(conf.rows, leaf);
+	conf.numrows += leaf->n;
 }
 
-void editorDelChar()
+/* The block of the row index that holds entry i */
+struct rowIndexBlock *rowIndexBlockOf(long long i)
 {
-	if (conf.cy == conf.numrows) 
+	return conf.index.blocks[i / ROW_INDEX_BLOCK];
+}
+
+/* Filling row with what the row index says about entry i, the row points into the mapping */
+void rowIndexRow(long long i, editor_row *row)
+{
+	struct rowIndexBlock *block = rowIndexBlockOf(i);
+	int k = i % ROW_INDEX_BLOCK;
+	row->size = block->len[k];
+	row->chars = conf.map + block->off[k];
+	row->rsize = 0;
+	row->render = NULL;
+	row->flags = ROW_MAPPED;
+	row->cap = 0;
+	row->gap = row->size;
+	row->hl = NULL;
+	row->hl_open = HL_STATE_NORMAL;
+	row->hl_state = conf.index.hl_state ? conf.index.hl_state[i] : HL_STATE_UNKNOWN;
+	if(!(block->flags[k] & ROW_INDEX_TABS))
 	{
-		return;
+		row->render = row->chars;
+		row->rsize = row->size;
+		row->flags |= ROW_RENDER_ALIAS | ROW_RENDER_VALID;
 	}
-	/* If the cursor is in the beginning of a line, we return immediately*/
-	if(conf.cx == 0 && conf.cy == 0)
+}
+
+/* Giving a leaf that is only in the row index rows of its own, which happens on the main thread the first time one of
+ * its rows is looked up or changed */
+void rowLeafExpand(rowLeaf *leaf)
+{
+	if(leaf->rows)
 	{
 		return;
 	}
-	editor_row *row = &conf.row[conf.cy];
-  	if (conf.cx > 0) {
-    		editorRowDeleteChar(row, conf.cx - 1);
-		conf.cx--;
-  	}else
+	leaf->rows = malloc(sizeof(editor_row) * ROW_LEAF_MAX);
+	int j;
+	for(j = 0; j < leaf->n; j++)
 	{
-		conf.cx = conf.row[conf.cy - 1].size;
-		editorRowAppendString(&conf.row[conf.cy - 1], row->chars, row->size);
-		editorDeleteRow(conf.cy);
-		conf.cy--;
+		rowIndexRow(leaf->first + j, &leaf->rows[j]);
 	}
 }
 
-/* ====== OUTPUT ======*/
-void editorScroll()
+/* Row j of a leaf for reading, a leaf that is only in the row index fills view instead of getting rows of its own,
+ * so workers and passes over the whole document read rows without changing the tree */
+editor_row *rowLeafView(rowLeaf *leaf, int j, editor_row *view)
 {
-	conf.rx = 0;
-	if(conf.cy < conf.numrows)
+	if(leaf->rows)
 	{
-		conf.rx = editorRowCxToRx(&conf.row[conf.cy], conf.cx);
+		return &leaf->rows[j];
 	}
-	
-	/* Checking if the user cursor is above the visible window, and if it is it scrolls up to that position*/
-	if(conf.cy < conf.rowoff)
+	rowIndexRow(leaf->first + j, view);
+	return view;
+}
+
+char *rowLeafChars(rowLeaf *leaf, int j)
+{
+	return leaf->rows ? leaf->rows[j].chars : conf.map + rowIndexBlockOf(leaf->first)->off[(leaf->first + j) % ROW_INDEX_BLOCK];
+}
+
+int rowLeafSize(rowLeaf *leaf, int j)
+{
+	return leaf->rows ? leaf->rows[j].size : rowIndexBlockOf(leaf->first)->len[(leaf->first + j) % ROW_INDEX_BLOCK];
+}
+
+int rowLeafMapped(rowLeaf *leaf, int j)
+{
+	return leaf->rows == NULL || (leaf->rows[j].flags & ROW_MAPPED);
+}
+
+int rowLeafState(rowLeaf *leaf, int j)
+{
+	return leaf->rows ? leaf->rows[j].hl_state : conf.index.hl_state[leaf->first + j];
+}
+
+void rowLeafSetState(rowLeaf *leaf, int j, int state)
+{
+	if(leaf->rows)
+	{
+		leaf->rows[j].hl_state = state;
+	}else
+	{
+		conf.index.hl_state[leaf->first + j] = state;
+	}
+}
+
+/* Returning the row with the given line number, the pointer stays valid until a row is inserted or deleted */
+editor_row *editorRowAt(int at)
+{
+	if(conf.rowcache && at >= conf.rowcache_base && at < conf.rowcache_base + conf.rowcache->n)
+	{
+		return &conf.rowcache->rows[at - conf.rowcache_base];
+	}
+	int base;
+	rowLeaf *leaf = rowTreeDescend(at, &base, 0);
+	if(leaf == NULL)
+	{
+		return NULL;
+	}
+	rowLeafExpand(leaf);
+	conf.rowcache = leaf;
+	conf.rowcache_base = base;
+	return &leaf->rows[at - base];
+}
+
+/* Shifting the rows of a leaf to open a slot at idx */
+editor_row *rowLeafOpen(rowLeaf *leaf, int idx)
+{
+	memmove(&leaf->rows[idx + 1], &leaf->rows[idx], sizeof(editor_row) * (leaf->n - idx));
+	leaf->n++;
+	return &leaf->rows[idx];
+}
+
+/* Making room for a new row at the given line number and returning it uninitialized */
+editor_row *rowTreeInsert(int at)
+{
+	conf.rowcache = NULL;
+	if(conf.rows == NULL)
+	{
+		conf.rows = rowTreeNewLeaf(-1);
+	}
+	int base = 0;
+	rowLeaf *leaf;
+	if(at < conf.numrows)
+	{
+		leaf = rowTreeDescend(at, &base, 0);
+	}else
+	{
+		leaf = rowTreeLast();
+		base = conf.numrows - leaf->n;
+	}
+	int idx = at - base;
+	rowLeafExpand(leaf);
+
+	if(leaf->n < ROW_LEAF_MAX)
+	{
+		if(leaf->n == 0)
+		{
+			leaf->count++; /* Only an empty document has an empty leaf, and that leaf is the root */
+		}else
+		{
+			rowTreeDescend(base, &base, 1);
+		}
+	}else
+	{
+		/* The leaf is full, so it is taken out of the tree and split in two */
+		rowLeaf *before, *rest, *after;
+		rowTreeSplit(conf.rows, base, &before, &rest);
+		rowTreeSplit(rest, leaf->n, &rest, &after);
+
+		rowLeaf *newleaf = rowTreeNewLeaf(-1);
+		/* Appending after the last leaf starts an empty one, so leaves stay full when rows are added at the end */
+		if(idx < leaf->n || leaf->next)
+		{
+			int half = leaf->n / 2;
+			memcpy(newleaf->rows, &leaf->rows[half], sizeof(editor_row) * (leaf->n - half));
+			newleaf->n = leaf->n - half;
+			leaf->n = half;
+		}
+		newleaf->prev = leaf;
+		newleaf->next = leaf->next;
+		if(leaf->next)
+		{
+			leaf->next->prev = newleaf;
+		}
+		leaf->next = newleaf;
+		rowLeaf *target = leaf;
+		if(idx > leaf->n || newleaf->n == 0)
+		{
+			idx -= leaf->n;
+			target = newleaf;
+		}
+		editor_row *row = rowLeafOpen(target, idx);
+		leaf->count = leaf->n;
+		newleaf->count = newleaf->n;
+		conf.rows = rowTreeMerge(rowTreeMerge(before, leaf), rowTreeMerge(newleaf, after));
+		conf.numrows++;
+		return row;
+	}
+	conf.numrows++;
+	return rowLeafOpen(leaf, idx);
+}
+
+/* Taking the row with the given line number out of the tree, the caller frees what the row holds */
+void rowTreeDelete(int at)
+{
+	conf.rowcache = NULL;
+	int base;
+	rowLeaf *leaf = rowTreeDescend(at, &base, 0);
+	if(leaf->n == 1)
+	{
+		/* The last row of a leaf goes away together with the leaf */
+		rowLeaf *before, *rest, *after;
+		rowTreeSplit(conf.rows, base, &before, &rest);
+		rowTreeSplit(rest, 1, &rest, &after);
+		if(leaf->prev)
+		{
+			leaf->prev->next = leaf->next;
+		}
+		if(leaf->next)
+		{
+			leaf->next->prev = leaf->prev;
+		}
+		rowTreeFreeLeaf(leaf);
+		conf.rows = rowTreeMerge(before, after);
+	}else
+	{
+		rowTreeDescend(at, &base, -1);
+		rowLeafExpand(leaf);
+		int idx = at - base;
+		memmove(&leaf->rows[idx], &leaf->rows[idx + 1], sizeof(editor_row) * (leaf->n - idx - 1));
+		leaf->n--;
+	}
+	conf.numrows--;
+}
+
+/* ====== ROW OPERATIONS ======*/
+
+/* Converting cx to rx to find out how many columns the user's cursor is to the left of the next tab stop(4) */
+/* Returning the character at index j of a row, skipping over the gap */
+char editorRowChar(editor_row *row, int j)
+{
+	return row->chars[j < row->gap ? j : j + row->cap - row->size];
+}
+
+int editorRowCxToRx(editor_row *row, int cx)
+{
+	/* Only tabs are wider than one column, memchr jumps from one tab to the next */
+	char *span[2] = {row->chars, row->chars + row->gap + row->cap - row->size};
+	int spanlen[2] = {row->gap < cx ? row->gap : cx, cx > row->gap ? cx - row->gap : 0};
+	int rx = 0;
+	int k;
+	for(k = 0; k < 2; k++)
+	{
+		char *p = span[k];
+		char *end = p + spanlen[k];
+		char *tab;
+		while((tab = memchr(p, '\t', end - p)) != NULL)
+		{
+			rx += tab - p;
+			rx += SIMPLR_TAB_STOP - (rx % SIMPLR_TAB_STOP);
+			p = tab + 1;
+		}
+		rx += end - p;
+	}
+	return rx;
+}
+
+/* Giving the render and the highlight of a row back to the row store, both were allocated rsize + 1 bytes long */
+void editorRowReleaseRender(editor_row *row)
+{
+	if(!(row->flags & ROW_RENDER_ALIAS))
+	{
+		rowStoreFree(&conf.store, row->render, row->rsize + 1);
+	}
+	rowStoreFree(&conf.store, row->hl, row->rsize + 1);
+	row->render = NULL;
+	row->hl = NULL;
+}
+
+void editorRowUpdate(editor_row *row)
+{
+	long long start = perfNowNs();
+	perf.rows_rendered++;
+	/* The characters before and after the gap are handled as two spans */
+	char *span[2] = {row->chars, row->chars + row->gap + row->cap - row->size};
+	int spanlen[2] = {row->gap, row->size - row->gap};
+	int tabs = scanCount(span[0], spanlen[0], '\t') + scanCount(span[1], spanlen[1], '\t');
+	int k;
+	editorRowReleaseRender(row);
+	row->flags &= ~(ROW_RENDER_ALIAS | ROW_HL_VALID);
+	/* Rows that still point into the mapped file and have no tabs render as they are, without a copy */
+	if(tabs == 0 && (row->flags & ROW_MAPPED))
+	{
+		row->render = row->chars;
+		row->rsize = row->size;
+		row->flags |= ROW_RENDER_ALIAS | ROW_RENDER_VALID;
+		perfRecord(PERF_ROW_UPDATE, start);
+		return;
+	}
+	/* The render is allocated at its exact width, so it can be freed by its size */
+	int rsize = tabs ? editorRowCxToRx(row, row->size) : row->size;
+	row->render = rowStoreAlloc(&conf.store, rsize + 1, NULL);
+	int idx = 0;
+	for(k = 0; k < 2; k++)
+	{
+		/* The text between tabs is copied in one go */
+		char *p = span[k];
+		char *end = p + spanlen[k];
+		while(p < end)
+		{
+			char *tab = memchr(p, '\t', end - p);
+			int len = (tab ? tab : end) - p;
+			memcpy(&row->render[idx], p, len);
+			idx += len;
+			if(tab == NULL)
+			{
+				break;
+			}
+			row->render[idx++] = '\t';
+			while(idx % SIMPLR_TAB_STOP != 0)
+			{
+				row->render[idx++] = ' ';
+			}
+			p = tab + 1;
+		}
+	}
+	row->render[idx] = '\0';
+	row->rsize = idx;
+	row->flags |= ROW_RENDER_VALID;
+	perfRecord(PERF_ROW_UPDATE, start);
+}
+
+/* Marking the render of a row as outdated after an edit, it is built again only once the row is drawn */
+void editorRowInvalidate(editor_row *row)
+{
+	row->flags &= ~ROW_RENDER_VALID;
+}
+
+/* Making sure the render of a row is up to date before it is drawn */
+void editorRowPrepareRender(editor_row *row)
+{
+	if(!(row->flags & ROW_RENDER_VALID))
+	{
+		editorRowUpdate(row);
+	}
+}
+
+void editorRowFreeRender(editor_row *row)
+{
+	editorRowReleaseRender(row);
+	row->rsize = 0;
+	row->flags &= ~(ROW_RENDER_ALIAS | ROW_RENDER_VALID | ROW_HL_VALID);
+}
+
+void editorRenderEvictRange(int from, int to)
+{
+	int j;
+	if(to > conf.numrows)
+	{
+		to = conf.numrows;
+	}
+	for(j = from; j < to; j++)
+	{
+		editorRowFreeRender(editorRowAt(j));
+	}
+}
+
+/* Keeping track of which rows hold render buffers while the screen rows [from, to) are drawn.
+ * A jump to another part of the file drops every cached render, and once too many are cached
+ * the ones further than a few screens away are dropped. */
+void editorRenderTrack(int from, int to)
+{
+	int margin = conf.screenrows * 4;
+	if(conf.render_lo >= conf.render_hi)
+	{
+		conf.render_lo = from;
+		conf.render_hi = to;
+	}else if(to < conf.render_lo - margin || from > conf.render_hi + margin)
+	{
+		editorRenderEvictRange(conf.render_lo, conf.render_hi);
+		conf.render_lo = from;
+		conf.render_hi = to;
+	}else
+	{
+		if(from < conf.render_lo)
+		{
+			conf.render_lo = from;
+		}
+		if(to > conf.render_hi)
+		{
+			conf.render_hi = to;
+		}
+	}
+	if(conf.render_hi - conf.render_lo > SIMPLR_RENDER_CACHE)
+	{
+		int lo = from - margin > conf.render_lo ? from - margin : conf.render_lo;
+		int hi = to + margin < conf.render_hi ? to + margin : conf.render_hi;
+		editorRenderEvictRange(conf.render_lo, lo);
+		editorRenderEvictRange(hi, conf.render_hi);
+		conf.render_lo = lo;
+		conf.render_hi = hi;
+	}
+}
+
+/* Counting an edit and widening the range of rows that differ from the file on disk to cover rows [from, to) */
+void editorMarkDirty(int from, int to)
+{
+	editorSearchCountStop(); /* Counts of a search don't hold once the rows change */
+	conf.dirty_flag++;
+	if(from < conf.dirty_lo)
+	{
+		conf.dirty_lo = from;
+	}
+	if(to > conf.dirty_hi)
+	{
+		conf.dirty_hi = to;
+	}
+	/* The changed rows are lexed again before anything after them is highlighted */
+	if(from < conf.hl_lo)
+	{
+		conf.hl_lo = from;
+	}
+	if(to > conf.hl_hi)
+	{
+		conf.hl_hi = to;
+	}
+}
+
+/* The document matches the file on disk again */
+void editorMarkClean()
+{
+	conf.dirty_flag = 0;
+	conf.dirty_lo = INT_MAX;
+	conf.dirty_hi = 0;
+}
+
+/* Filling a new row that owns chars, len characters in an allocation of cap bytes */
+void editorRowInitOwned(editor_row *row, char *chars, int len, int cap)
+{
+	row->size = len;
+	row->chars = chars;
+	row->rsize = 0;
+	row->render = NULL;
+	row->flags = 0;
+	row->cap = cap;
+	row->gap = len;
+	row->hl = NULL;
+	row->hl_state = HL_STATE_UNKNOWN;
+}
+
+void editorInsertRow(int at, char *s, size_t len)
+{
+	if(at < 0 || at > conf.numrows)
+	{
+		return; 
+	}
+	/* s may point into another row, so it is copied before the tree moves rows around */
+	int cap;
+	char *chars = rowStoreAlloc(&conf.store, len + 1, &cap);
+	memcpy(chars, s, len);
+	chars[len] = '\0';
+	editorUndoRecord(UNDO_INSERT_ROW, at, 0, NULL, 0, chars, len);
+	editorJournalWrite(UNDO_INSERT_ROW, at, 0, 0, chars, len);
+	editorRowInitOwned(rowTreeInsert(at), chars, len, cap);
+	/* Keeping rows that hold renders inside the tracked range as the rows below move down */
+	if(at < conf.render_hi)
+	{
+		conf.render_hi++;
+		if(at < conf.render_lo)
+		{
+			conf.render_lo++;
+		}
+	}
+	if(at < conf.dirty_hi)
+	{
+		conf.dirty_hi++;
+	}
+	if(at < conf.hl_hi)
+	{
+		conf.hl_hi++;
+	}
+	editorMarkDirty(at, at + 1);
+}
+/* Function for freeing memory held by editor_row that we are deleting */
+void editorFreeRow(editor_row *row)
+{
+	editorRowReleaseRender(row);
+	if(!(row->flags & ROW_MAPPED))
+	{
+		rowStoreFree(&conf.store, row->chars, row->cap);
+	}
+}
+
+/* Copying a row that still points into the mapped file into its own buffer, so it can be edited */
+void editorRowMakeOwned(editor_row *row)
+{
+	if(!(row->flags & ROW_MAPPED))
+	{
+		return;
+	}
+	char *chars = rowStoreAlloc(&conf.store, row->size + 1, &row->cap);
+	memcpy(chars, row->chars, row->size);
+	chars[row->size] = '\0';
+	row->chars = chars;
+	row->gap = row->size;
+	if(row->flags & ROW_RENDER_ALIAS)
+	{
+		/* The render pointed into the mapping as well, a new one is built when the row is drawn again */
+		row->flags &= ~ROW_RENDER_ALIAS;
+		row->render = NULL;
+	}
+	row->flags &= ~ROW_MAPPED;
+}
+
+/* Giving a row new text all at once, for edits that rewrite whole rows */
+void editorRowSet(editor_row *row, const char *s, int len)
+{
+	if(row->flags & ROW_RENDER_ALIAS)
+	{
+		row->flags &= ~ROW_RENDER_ALIAS;
+		row->render = NULL;
+	}
+	if(!(row->flags & ROW_MAPPED))
+	{
+		rowStoreFree(&conf.store, row->chars, row->cap);
+	}
+	row->chars = rowStoreAlloc(&conf.store, len + 1, &row->cap);
+	if(len > 0)
+	{
+		memcpy(row->chars, s, len);
+	}
+	row->chars[len] = '\0';
+	row->size = row->gap = len;
+	row->flags &= ~ROW_MAPPED;
+	editorRowInvalidate(row);
+}
+
+/* Moving the gap of an owned row so that it starts at index at */
+void editorRowMoveGap(editor_row *row, int at)
+{
+	int gaplen = row->cap - row->size;
+	if(at < row->gap)
+	{
+		memmove(&row->chars[at + gaplen], &row->chars[at], row->gap - at);
+	}else if(at > row->gap)
+	{
+		memmove(&row->chars[row->gap], &row->chars[row->gap + gaplen], at - row->gap);
+	}
+	row->gap = at;
+}
+
+/* Making sure the gap of an owned row fits len more characters, the allocation grows geometrically */
+void editorRowReserve(editor_row *row, int len)
+{
+	/* One byte of the gap is always kept free for the terminating null character */
+	if(row->cap - row->size > len)
+	{
+		return;
+	}
+	int newcap = row->cap * 2;
+	if(newcap < row->size + len + 1)
+	{
+		newcap = row->size + len + 1;
+	}
+	if(newcap < 16)
+	{
+		newcap = 16;
+	}
+	int tail = row->size - row->gap;
+	char *chars = rowStoreAlloc(&conf.store, newcap, &newcap);
+	memcpy(chars, row->chars, row->gap);
+	memcpy(&chars[newcap - tail], &row->chars[row->cap - tail], tail);
+	rowStoreFree(&conf.store, row->chars, row->cap);
+	row->chars = chars;
+	row->cap = newcap;
+}
+
+/* Replacing remove characters at index at with len characters from s, for undo and redo. The caller marks the
+ * row dirty, so a whole batch of splices is marked at once. */
+void editorRowSplice(int filerow, int at, int remove, const char *s, int len)
+{
+	editor_row *row = editorRowAt(filerow);
+	editorJournalWrite(UNDO_SPLICE, filerow, at, remove, s, len);
+	editorRowMakeOwned(row);
+	editorRowMoveGap(row, at);
+	row->size -= remove; /* The removed characters are the first ones after the gap, the gap grows over them */
+	editorRowReserve(row, len);
+	memcpy(&row->chars[row->gap], s, len);
+	row->gap += len;
+	row->size += len;
+	editorRowInvalidate(row);
+}
+
+/* Closing the gap so the row is one contiguous string */
+char *editorRowFlatten(editor_row *row)
+{
+	if(row->flags & ROW_MAPPED)
+	{
+		return row->chars; /* Mapped rows never have a gap, and aren't null terminated */
+	}
+	editorRowMoveGap(row, row->size);
+	row->chars[row->size] = '\0';
+	return row->chars;
+}
+/* Deleting a single row by it's line number */
+void editorDeleteRow(int at)
+{
+	if(at < 0 || at >= conf.numrows)
+	{
+		return;
+	}
+	editor_row *row = editorRowAt(at);
+	if(!conf.undo.paused)
+	{
+		editorUndoRecord(UNDO_DELETE_ROW, at, 0, editorRowFlatten(row), row->size, NULL, 0);
+	}
+	editorJournalWrite(UNDO_DELETE_ROW, at, 0, 0, NULL, 0);
+	editorFreeRow(row);
+	rowTreeDelete(at);
+	if(at < conf.render_hi)
+	{
+		conf.render_hi--;
+		if(at < conf.render_lo)
+		{
+			conf.render_lo--;
+		}
+	}
+	/* The rows after it are unchanged, only the place where they meet the rows before has to be written again */
+	if(at < conf.dirty_hi)
+	{
+		conf.dirty_hi--;
+	}
+	if(at < conf.hl_hi)
+	{
+		conf.hl_hi--;
+	}
+	editorMarkDirty(at, at);
+}
+
+void editorRowInsertChar(int filerow, int at, int c)
+{
+	editor_row *row = editorRowAt(filerow);
+	if(at < 0 || at > row->size)
+	{
+		at = row->size;
+	}
+	char ch = c;
+	editorUndoRecord(UNDO_SPLICE, filerow, at, NULL, 0, &ch, 1);
+	editorJournalWrite(UNDO_SPLICE, filerow, at, 0, &ch, 1);
+	editorRowMakeOwned(row);
+	editorRowReserve(row, 1);
+	editorRowMoveGap(row, at);
+	row->chars[row->gap++] = c;
+	row->size++;
+	editorRowInvalidate(row);
+	editorMarkDirty(filerow, filerow + 1);
+}
+
+/* Inserting a string into the row at the given index */
+void editorRowInsertString(int filerow, int at, const char *s, size_t len)
+{
+	editor_row *row = editorRowAt(filerow);
+	if(at < 0 || at > row->size)
+	{
+		at = row->size;
+	}
+	editorUndoRecord(UNDO_SPLICE, filerow, at, NULL, 0, s, len);
+	editorJournalWrite(UNDO_SPLICE, filerow, at, 0, s, len);
+	editorRowMakeOwned(row);
+	editorRowReserve(row, len);
+	editorRowMoveGap(row, at);
+	memcpy(&row->chars[row->gap], s, len);
+	row->gap += len;
+	row->size += len;
+	editorRowInvalidate(row);
+	editorMarkDirty(filerow, filerow + 1);
+}
+
+/* Function for appending a string to the end of the row */
+void editorRowAppendString(int filerow, char *s, size_t len)
+{
+	editor_row *row = editorRowAt(filerow);
+	editorUndoRecord(UNDO_SPLICE, filerow, row->size, NULL, 0, s, len);
+	editorJournalWrite(UNDO_SPLICE, filerow, row->size, 0, s, len);
+	editorRowMakeOwned(row);
+	editorRowReserve(row, len);
+	editorRowMoveGap(row, row->size);
+	memcpy(&row->chars[row->size], s, len);
+  	row->size += len;
+	row->gap = row->size;
+  	row->chars[row->size] = '\0';
+  	editorRowInvalidate(row);
+  	editorMarkDirty(filerow, filerow + 1);
+}
+void editorRowDeleteChar(int filerow, int at)
+{
+	editor_row *row = editorRowAt(filerow);
+	if(at < 0 || at >= row->size)
+	{
+		return; 
+	}
+	char ch = editorRowChar(row, at);
+	editorUndoRecord(UNDO_SPLICE, filerow, at, &ch, 1, NULL, 0);
+	editorJournalWrite(UNDO_SPLICE, filerow, at, 1, NULL, 0);
+	editorRowMakeOwned(row);
+	/* The character is dropped from the end of the text before the gap, so deleting backwards never moves anything */
+	editorRowMoveGap(row, at + 1);
+	row->gap--;
+	row->size--;
+	editorRowInvalidate(row);
+	editorMarkDirty(filerow, filerow + 1);
+}
+
+/* Cutting a row off at the given index */
+void editorRowTruncate(int filerow, int at)
+{
+	editor_row *row = editorRowAt(filerow);
+	if(at < 0 || at >= row->size)
+	{
+		return;
+	}
+	if(!conf.undo.paused)
+	{
+		editorUndoRecord(UNDO_SPLICE, filerow, at, editorRowFlatten(row) + at, row->size - at, NULL, 0);
+	}
+	editorJournalWrite(UNDO_SPLICE, filerow, at, row->size - at, NULL, 0);
+	/* A mapped row is cut by shortening it, the mapping itself is read-only */
+	if(!(row->flags & ROW_MAPPED))
+	{
+		if(row->gap < at)
+		{
+			editorRowMoveGap(row, at);
+		}
+		row->chars[at] = '\0';
+	}
+	row->size = at;
+	row->gap = at;
+	editorRowInvalidate(row);
+	editorMarkDirty(filerow, filerow + 1);
+}
+
+/* ====== FILE INPUT/OUTPUT ======*/
+/* Writing a batch of buffers completely, writev may stop after any of them.
+ * With off the buffers are written at that offset instead of the file position, and off is moved past them. */
+int editorWritevAll(int fd, struct iovec *iov, int cnt, off_t *off)
+{
+	while(cnt > 0)
+	{
+		ssize_t n = off ? pwritev(fd, iov, cnt, *off) : writev(fd, iov, cnt);
+		if(n == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		if(off)
+		{
+			*off += n;
+		}
+		while(cnt > 0 && (size_t)n >= iov->iov_len)
+		{
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if(cnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+/* Adding len bytes at base to what a save writes, an entry without a base stands for bytes the file already holds */
+void editorSaveAdd(struct saveJob *job, char *base, size_t len)
+{
+	if(len == 0)
+	{
+		return;
+	}
+	/* Pieces that follow each other in memory become one entry, so an unchanged run of the mapped file goes out at once */
+	if(job->iovcnt > 0)
+	{
+		struct iovec *last = &job->iov[job->iovcnt - 1];
+		if((base == NULL && last->iov_base == NULL) ||
+		   (base && last->iov_base && (char *)last->iov_base + last->iov_len == base))
+		{
+			last->iov_len += len;
+			return;
+		}
+	}
+	if(job->iovcnt == job->iovcap)
+	{
+		job->iovcap = job->iovcap ? job->iovcap * 2 : 64;
+		job->iov = realloc(job->iov, sizeof(struct iovec) * job->iovcap);
+	}
+	job->iov[job->iovcnt].iov_base = base;
+	job->iov[job->iovcnt++].iov_len = len;
+}
+
+/* Reserving len bytes in the blocks edited rows are copied into, so the save doesn't depend on rows that keep changing */
+char *editorSaveCopy(struct saveJob *job, size_t len)
+{
+	struct saveChunk *chunk = job->chunks;
+	if(chunk == NULL || chunk->len + len > chunk->cap)
+	{
+		size_t cap = len > SIMPLR_SAVE_CHUNK ? len : SIMPLR_SAVE_CHUNK;
+		chunk = malloc(sizeof(struct saveChunk) + cap);
+		chunk->cap = cap;
+		chunk->len = 0;
+		chunk->next = job->chunks;
+		job->chunks = chunk;
+	}
+	char *p = chunk->data + chunk->len;
+	chunk->len += len;
+	return p;
+}
+
+/* Taking the snapshot of rows [lo, hi) that starts at byte offset off.
+ * With samefile the mapped file is the one written over, so mapped rows still at their place are skipped,
+ * and a mapped row that moved would read bytes that are overwritten on the way, which fails with -1. */
+int editorSaveCollect(struct saveJob *job, int lo, int hi, long long off, int samefile)
+{
+	static char newline[] = "\n";
+	int base = 0;
+	rowLeaf *leaf = lo < hi ? rowTreeDescend(lo, &base, 0) : NULL;
+	int j = lo - base;
+	int y;
+	editor_row view;
+	for(y = lo; y < hi; y++, j++)
+	{
+		if(j == leaf->n)
+		{
+			leaf = leaf->next;
+			j = 0;
+		}
+		if(leaf->rows == NULL)
+		{
+			/* Rows only in the row index are written as they are in the mapping, newlines included, up to a converted one */
+			struct rowIndexBlock *block = rowIndexBlockOf(leaf->first);
+			int i = (leaf->first + j) % ROW_INDEX_BLOCK;
+			int k = j;
+			while(k < leaf->n && y + (k - j) < hi && !(block->flags[i + k - j] & ROW_INDEX_CONVERTED))
+			{
+				k++;
+			}
+			if(k > j)
+			{
+				int last = i + k - j - 1;
+				long long len = block->off[last] + block->len[last] + 1 - block->off[i];
+				if(samefile && block->off[i] != off)
+				{
+					return -1;
+				}
+				editorSaveAdd(job, samefile ? NULL : conf.map + block->off[i], len);
+				off += len;
+				y += k - j - 1;
+				j = k - 1;
+				continue;
+			}
+		}
+		editor_row *row = rowLeafView(leaf, j, &view);
+		if(row->flags & ROW_MAPPED)
+		{
+			/* The newline of a mapped row is taken from the mapping too when it is a plain \n, then whole runs of rows are contiguous */
+			int newline_mapped = row->chars + row->size < conf.map + conf.mapsize && row->chars[row->size] == '\n';
+			if(samefile && row->chars - conf.map != off)
+			{
+				return -1;
+			}
+			editorSaveAdd(job, samefile ? NULL : row->chars, row->size);
+			if(newline_mapped)
+			{
+				editorSaveAdd(job, samefile ? NULL : row->chars + row->size, 1);
+			}else
+			{
+				editorSaveAdd(job, newline, 1);
+			}
+		}else
+		{
+			char *p = editorSaveCopy(job, row->size + 1);
+			memcpy(p, row->chars, row->gap);
+			memcpy(p + row->gap, row->chars + row->gap + row->cap - row->size, row->size - row->gap);
+			p[row->size] = '\n';
+			editorSaveAdd(job, p, row->size + 1);
+		}
+		off += row->size + 1;
+	}
+	return 0;
+}
+
+/* Writing over the file isn't crash-atomic like replacing it is, and the journal no longer matches a file that was
+ * written to. The changed bytes have to be one run that doesn't cross a page: if the editor is killed, such a write
+ * is either in the page cache whole or not at all. A power loss before fdatasync returns can still leave the page
+ * half written, so only one page is ever at stake. Changes that are larger or scattered are saved through a temporary
+ * file instead. */
+int editorSaveOnePage(struct saveJob *job)
+{
+	long long off = job->from, first = -1, last = 0;
+	int j, runs = 0;
+	for(j = 0; j < job->iovcnt; j++)
+	{
+		if(job->iov[j].iov_base)
+		{
+			if(first == -1)
+			{
+				first = off;
+			}
+			last = off + job->iov[j].iov_len;
+			runs += j == 0 || job->iov[j - 1].iov_base == NULL;
+		}
+		off += job->iov[j].iov_len;
+	}
+	long page = sysconf(_SC_PAGESIZE);
+	return first == -1 || (runs == 1 && first / page == (last - 1) / page);
+}
+
+/* Deciding how the document gets to disk and taking a snapshot of the rows that have to be written */
+void editorSaveSnapshot(struct saveJob *job)
+{
+	int lo = conf.dirty_lo < conf.numrows ? conf.dirty_lo : conf.numrows;
+	int hi = conf.dirty_hi < conf.numrows ? conf.dirty_hi : conf.numrows;
+	if(hi < lo)
+	{
+		hi = lo;
+	}
+	long long from = 0, total = 0;
+	rowLeaf *leaf;
+	int j, y = 0;
+	for(leaf = rowTreeFirst(); leaf; leaf = leaf->next)
+	{
+		/* Lengths of rows only in the row index are summed straight from its array */
+		const int *len = leaf->rows ? NULL : &rowIndexBlockOf(leaf->first)->len[leaf->first % ROW_INDEX_BLOCK];
+		long long sum = 0;
+		for(j = 0; j < leaf->n; j++)
+		{
+			sum += (len ? len[j] : leaf->rows[j].size) + 1;
+			if(y + j + 1 == lo)
+			{
+				from = total + sum;
+			}
+		}
+		total += sum;
+		y += leaf->n;
+	}
+	job->total = total;
+	job->dirty_flag = conf.dirty_flag;
+	job->dirty_lo = conf.dirty_lo;
+
+	/* The start of the file can only be kept when nobody else changed the file since it was loaded or saved */
+	struct stat st;
+	job->mode = SAVE_FULL;
+	if(conf.filestat_valid && stat(job->target, &st) == 0 &&
+	   st.st_dev == conf.filestat.st_dev && st.st_ino == conf.filestat.st_ino &&
+	   st.st_size == conf.filestat.st_size &&
+	   st.st_mtim.tv_sec == conf.filestat.st_mtim.tv_sec && st.st_mtim.tv_nsec == conf.filestat.st_mtim.tv_nsec)
+	{
+		job->mode = total == st.st_size ? SAVE_INPLACE : SAVE_PREFIX;
+	}
+	/* Writing over a file that another buffer has mapped would change the rows of that buffer */
+	struct fileMap *file;
+	for(file = conf.files; file && job->mode == SAVE_INPLACE; file = file->next)
+	{
+		if(file->st.st_dev == st.st_dev && file->st.st_ino == st.st_ino && (file != conf.file || file->refs > 1))
+		{
+			job->mode = SAVE_PREFIX;
+		}
+	}
+	if(job->mode == SAVE_INPLACE)
+	{
+		/* Edits that kept the length only need the rows between the first and the last change written over the file */
+		int samefile = conf.map && st.st_dev == conf.map_dev && st.st_ino == conf.map_ino;
+		job->from = from;
+		if(editorSaveCollect(job, lo, hi, from, samefile) == 0 && editorSaveOnePage(job))
+		{
+			return;
+		}
+		job->iovcnt = 0;
+		job->mode = SAVE_PREFIX;
+	}
+	if(job->mode == SAVE_FULL)
+	{
+		lo = 0;
+		from = 0;
+	}
+	job->from = from;
+	editorSaveCollect(job, lo, conf.numrows, from, 0);
+}
+
+/* Copying the first len bytes of the file at path to fd, the kernel copies them without going through the editor where it can */
+int editorSaveCopyPrefix(const char *path, int fd, long long len)
+{
+	int in = open(path, O_RDONLY);
+	if(in == -1)
+	{
+		return errno;
+	}
+	int err = 0;
+	while(len > 0)
+	{
+		ssize_t n = copy_file_range(in, NULL, fd, NULL, len, 0);
+		if(n > 0)
+		{
+			len -= n;
+			continue;
+		}
+		if(n == 0)
+		{
+			err = EIO; /* The file got shorter than it was */
+		}else if(errno == EINTR)
+		{
+			continue;
+		}else if(errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP)
+		{
+			err = errno;
+		}
+		break;
+	}
+	/* Older kernels and some file systems can't copy between the two files, then the copy goes through a buffer */
+	char *buf = NULL;
+	while(!err && len > 0)
+	{
+		if(buf == NULL)
+		{
+			buf = malloc(SIMPLR_SAVE_CHUNK);
+		}
+		ssize_t n = read(in, buf, len < SIMPLR_SAVE_CHUNK ? len : SIMPLR_SAVE_CHUNK);
+		if(n == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if(n <= 0)
+		{
+			err = n == 0 ? EIO : errno;
+			break;
+		}
+		struct iovec iov = {buf, n};
+		if(editorWritevAll(fd, &iov, 1, NULL) == -1)
+		{
+			err = errno;
+		}
+		len -= n;
+	}
+	free(buf);
+	close(in);
+	return err;
+}
+
+/* Writing the snapshot over the file itself, only the changed bytes are written */
+int editorSaveInPlace(struct saveJob *job)
+{
+	int fd = open(job->target, O_WRONLY);
+	if(fd == -1)
+	{
+		return errno;
+	}
+	int err = 0;
+	off_t off = job->from;
+	int i = 0;
+	while(!err && i < job->iovcnt)
+	{
+		if(job->iov[i].iov_base == NULL)
+		{
+			off += job->iov[i++].iov_len;
+			continue;
+		}
+		int cnt = 0;
+		while(i + cnt < job->iovcnt && cnt < IOV_MAX && job->iov[i + cnt].iov_base)
+		{
+			cnt++;
+		}
+		if(editorWritevAll(fd, &job->iov[i], cnt, &off) == -1)
+		{
+			err = errno;
+		}
+		i += cnt;
+	}
+	if(!err && fdatasync(fd) == -1)
+	{
+		err = errno;
+	}
+	if(!err && fstat(fd, &job->st) == -1)
+	{
+		err = errno;
+	}
+	if(close(fd) == -1 && !err)
+	{
+		err = errno;
+	}
+	return err;
+}
+
+/* Writing the document into a temporary file next to the target that replaces it once it is on disk,
+ * rows may still point into the mapping of the original and a crash must never leave it half written */
+int editorSaveReplace(struct saveJob *job)
+{
+	char *slash = strrchr(job->target, '/');
+	int dirlen = slash ? slash - job->target + 1 : 0;
+	char *tmpname = malloc(strlen(job->target) + 10);
+	sprintf(tmpname, "%.*s.%s.XXXXXX", dirlen, job->target, job->target + dirlen);
+	int fd = mkstemp(tmpname);
+	if(fd == -1)
+	{
+		int err = errno;
+		free(tmpname);
+		return err;
+	}
+	/* Keeping the permissions and owner of the file that is replaced */
+	struct stat st;
+	if(stat(job->target, &st) == 0)
+	{
+		fchmod(fd, st.st_mode & 07777);
+		fchown(fd, st.st_uid, st.st_gid);
+	}else
+	{
+		fchmod(fd, 0644);
+	}
+	int err = 0;
+	if(job->from > 0)
+	{
+		err = editorSaveCopyPrefix(job->target, fd, job->from);
+	}
+	int i;
+	for(i = 0; !err && i < job->iovcnt; i += IOV_MAX)
+	{
+		int cnt = job->iovcnt - i < IOV_MAX ? job->iovcnt - i : IOV_MAX;
+		if(editorWritevAll(fd, &job->iov[i], cnt, NULL) == -1)
+		{
+			err = errno;
+		}
+	}
+	if(!err && fsync(fd) == -1)
+	{
+		err = errno;
+	}
+	if(!err && fstat(fd, &job->st) == -1)
+	{
+		err = errno;
+	}
+	if(close(fd) == -1 && !err)
+	{
+		err = errno;
+	}
+	if(!err && rename(tmpname, job->target) == -1)
+	{
+		err = errno;
+	}
+	if(err)
+	{
+		unlink(tmpname);
+	}else
+	{
+		/* Making the rename itself durable */
+		char *dir = strndup(job->target, dirlen ? dirlen : 1);
+		int dirfd = open(dirlen ? dir : ".", O_RDONLY | O_DIRECTORY);
+		if(dirfd != -1)
+		{
+			fsync(dirfd);
+			close(dirfd);
+		}
+		free(dir);
+	}
+	free(tmpname);
+	return err;
+}
+
+/* Running a save, on the save thread or right away for small documents */
+void *editorSaveRun(void *arg)
+{
+	struct saveJob *job = arg;
+	job->error = job->mode == SAVE_INPLACE ? editorSaveInPlace(job) : editorSaveReplace(job);
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+	if(job->threaded)
+	{
+		editorWake();
+	}
+	return NULL;
+}
+
+/* Taking over the result of the running save once it is done, with block set it is waited for */
+void editorSaveWait(int block)
+{
+	struct saveJob *job = conf.save;
+	if(job == NULL || (!block && !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)))
+	{
+		return;
+	}
+	if(job->threaded)
+	{
+		pthread_join(job->thread, NULL);
+	}
+	conf.save = NULL;
+	if(job->error == 0)
+	{
+		conf.filestat = job->st;
+		conf.filestat_valid = 1;
+		editorJournalSaved(1);
+		/* Edits made while the save was running still differ from the file */
+		if(conf.dirty_flag == job->dirty_flag)
+		{
+			conf.dirty_flag = 0;
+		}
+		statusMessage("Changes written to disk(%lld bytes)", job->total);
+	}else
+	{
+		/* The rows that weren't saved are dirty again, the rows after them may have moved since */
+		if(job->dirty_lo < conf.dirty_lo)
+		{
+			conf.dirty_lo = job->dirty_lo;
+		}
+		conf.dirty_hi = conf.numrows;
+		if(job->mode == SAVE_INPLACE)
+		{
+			conf.filestat_valid = 0; /* The file may be half written, the next save writes all of it */
+		}
+		editorJournalSaved(0);
+		statusMessage("Couldn't save changes to disk. Error: %s", strerror(job->error));
+	}
+	while(job->chunks)
+	{
+		struct saveChunk *next = job->chunks->next;
+		free(job->chunks);
+		job->chunks = next;
+	}
+	free(job->iov);
+	free(job->target);
+	free(job);
+}
+
+/* A loaded row that a save writes differently than the file holds it, because its \r or the missing newline at the end of
+ * the file isn't kept. Such rows count as changed, so a save that keeps the start of the file doesn't keep them. */
+void editorMarkConverted(int filerow)
+{
+	if(filerow < conf.dirty_lo)
+	{
+		conf.dirty_lo = filerow;
+	}
+	if(filerow + 1 > conf.dirty_hi)
+	{
+		conf.dirty_hi = filerow + 1;
+	}
+}
+
+/* Making entry i of the row index describe the line from p to lineend, newline tells if a newline follows it in the
+ * file. Returns EFBIG if the line is too long for a row, 0 otherwise. */
+int editorOpenMappedRow(struct loadJob *job, struct rowIndexBlock *block, long long i, const char *p, const char *lineend,
+		int newline)
+{
+	size_t linelen = lineend - p;
+	if(linelen > 0 && p[linelen - 1] == '\r')
+	{
+		linelen--;
+	}
+	/* Lengths of rows are ints */
+	if(linelen > INT_MAX)
+	{
+		return EFBIG;
+	}
+	int k = i % ROW_INDEX_BLOCK;
+	block->off[k] = p - job->map;
+	block->len[k] = linelen;
+	block->flags[k] = 0;
+	if(!newline || linelen != (size_t)(lineend - p))
+	{
+		block->flags[k] |= ROW_INDEX_CONVERTED;
+		if(i < job->converted_lo)
+		{
+			job->converted_lo = i;
+		}
+		job->converted_hi = i + 1;
+	}
+	return 0;
+}
+
+/* Flagging the rows of index entries from first on that hold a tab, the text of all of them is searched at once */
+void editorOpenMappedTabs(struct loadJob *job, long long first, const char *start, const char *end)
+{
+	long long i = first;
+	const char *tab = start;
+	while((tab = memchr(tab, '\t', end - tab)) != NULL)
+	{
+		long long at = tab - job->map;
+		struct rowIndexBlock *block = job->blocks[i / ROW_INDEX_BLOCK];
+		while(block->off[i % ROW_INDEX_BLOCK] + block->len[i % ROW_INDEX_BLOCK] <= at)
+		{
+			i++;
+			block = job->blocks[i / ROW_INDEX_BLOCK];
+		}
+		block->flags[i % ROW_INDEX_BLOCK] |= ROW_INDEX_TABS;
+		if(++i == job->indexed)
+		{
+			break;
+		}
+		tab = job->map + job->blocks[i / ROW_INDEX_BLOCK]->off[i % ROW_INDEX_BLOCK];
+	}
+}
+
+/* The loader thread. It finds the line boundaries of the mapping and hands the rows over to the main thread a chunk at
+ * a time. Only the mapping and the blocks it fills are touched here, so no row lock is needed. */
+void *editorLoadRun(void *arg)
+{
+	struct loadJob *job = arg;
+	char *p = job->map;
+	char *end = job->map + job->size;
+	size_t ends[ROW_LEAF_MAX];
+	size_t want = 0; /* The first chunk is a single leaf, which holds the rows of the first screen */
+	int error = 0;
+	madvise(job->map, job->size, MADV_SEQUENTIAL);
+	while(p < end && error == 0 && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+	{
+		char *from = p;
+		/* The newlines of a whole leaf are found in one pass of the scan kernel */
+		do
+		{
+			long long first = job->indexed;
+			if(first % ROW_INDEX_BLOCK == 0)
+			{
+				/* Leaves start at multiples of ROW_LEAF_MAX, so a leaf never crosses into the next block */
+				job->block = malloc(sizeof(struct rowIndexBlock));
+				pthread_mutex_lock(&job->lock);
+				job->blocks = realloc(job->blocks, sizeof(struct rowIndexBlock *) * (job->nblocks + 1));
+				job->blocks[job->nblocks++] = job->block;
+				pthread_mutex_unlock(&job->lock);
+			}
+			char *start = p;
+			int found = scanNewlines(start, end - start, ends, ROW_LEAF_MAX);
+			int j;
+			for(j = 0; j < found && error == 0; j++)
+			{
+				error = editorOpenMappedRow(job, job->block, first + j, p, start + ends[j], 1);
+				p = start + ends[j] + 1;
+			}
+			/* Text after the last newline of the file is a row too */
+			if(found < ROW_LEAF_MAX && p < end && error == 0)
+			{
+				error = editorOpenMappedRow(job, job->block, first + j++, p, end, 0);
+				p = end;
+			}
+			job->indexed = first + j;
+			editorOpenMappedTabs(job, first, start, p);
+		} while(p < end && error == 0 && (size_t)(p - from) < want);
+		want = SIMPLR_LOAD_CHUNK;
+		/* Line numbers are ints */
+		if(job->indexed > INT_MAX)
+		{
+			error = EFBIG;
+		}
+		if(error)
+		{
+			break;
+		}
+		pthread_mutex_lock(&job->lock);
+		job->rows = job->indexed;
+		job->rows_converted_lo = job->converted_lo;
+		job->rows_converted_hi = job->converted_hi;
+		job->end = p - job->map;
+		pthread_cond_signal(&job->ready);
+		pthread_mutex_unlock(&job->lock);
+		editorWake();
+	}
+	madvise(job->map, job->size, MADV_NORMAL);
+	pthread_mutex_lock(&job->lock);
+	job->error = error;
+	job->finished = 1;
+	pthread_cond_signal(&job->ready);
+	pthread_mutex_unlock(&job->lock);
+	editorWake();
+	return NULL;
+}
+
+/* Adding the index entries up to rows after the last row, as compact leaves. lo and hi are the converted rows so far. */
+void editorLoadAdd(long long rows, int lo, int hi)
+{
+	struct rowIndex *index = &conf.index;
+	long long first = index->n;
+	if(index->hl_state && rows > index->hl_cap)
+	{
+		long long cap = index->hl_cap * 2 > rows ? index->hl_cap * 2 : rows;
+		index->hl_state = realloc(index->hl_state, cap);
+		memset(&index->hl_state[index->hl_cap], HL_STATE_UNKNOWN, cap - index->hl_cap);
+		index->hl_cap = cap;
+	}
+	index->n = rows;
+
+	int y = conf.numrows;
+	long long i;
+	for(i = first; i < rows; i += ROW_LEAF_MAX)
+	{
+		rowLeaf *leaf = rowTreeNewLeaf(i);
+		leaf->n = rows - i < ROW_LEAF_MAX ? rows - i : ROW_LEAF_MAX;
+		rowTreeAppendLeaf(leaf);
+	}
+	/* The converted rows form one range, so marking the ends of its part among the new rows is enough */
+	if(lo < first)
+	{
+		lo = first;
+	}
+	if(lo < hi)
+	{
+		editorMarkConverted(y + lo - first);
+		editorMarkConverted(y + hi - 1 - first);
+	}
+	/* The new rows are lexed before they are drawn, the ones before keep their state */
+	if(y < conf.hl_lo)
+	{
+		conf.hl_lo = y;
+	}
+	if(conf.numrows > conf.hl_hi)
+	{
+		conf.hl_hi = conf.numrows;
+	}
+}
+
+/* Taking the blocks the loader thread made since the last call into the row index */
+void editorLoadBlocks(struct loadJob *job)
+{
+	struct rowIndex *index = &conf.index;
+	if(job->nblocks > index->nblocks)
+	{
+		index->blocks = realloc(index->blocks, sizeof(struct rowIndexBlock *) * job->nblocks);
+		memcpy(&index->blocks[index->nblocks], &job->blocks[index->nblocks],
+				sizeof(struct rowIndexBlock *) * (job->nblocks - index->nblocks));
+		index->nblocks = job->nblocks;
+	}
+}
+
+/* Ending the load of the shown buffer once the loader thread stopped, the row index as it is now becomes the one
+ * of the file. Returns the errno the load failed with, 0 if it didn't fail. */
+int editorLoadEnd()
+{
+	struct loadJob *job = conf.load;
+	if(job->threaded)
+	{
+		pthread_join(job->thread, NULL);
+	}
+	editorLoadBlocks(job); /* A block the loader thread stopped in goes with the file too */
+	conf.file->index = conf.index;
+	conf.file->index.hl_state = NULL;
+	conf.file->index.hl_cap = 0;
+	conf.file->converted_lo = job->converted_lo;
+	conf.file->converted_hi = job->converted_hi;
+	/* The index of a stopped load only holds part of the file, so the file is never shared with another buffer */
+	conf.file->loading = __atomic_load_n(&job->cancel, __ATOMIC_RELAXED);
+	int error = job->error;
+	free(job->blocks);
+	pthread_mutex_destroy(&job->lock);
+	pthread_cond_destroy(&job->ready);
+	free(job);
+	conf.load = NULL;
+	return error;
+}
+
+/* Adding the rows the loader thread handed over since the last call, the load ends once all of them are added */
+void editorLoadPoll()
+{
+	struct loadJob *job = conf.load;
+	if(job == NULL)
+	{
+		return;
+	}
+	pthread_mutex_lock(&job->lock);
+	editorLoadBlocks(job);
+	long long rows = job->rows;
+	int lo = job->rows_converted_lo, hi = job->rows_converted_hi;
+	job->loaded = job->end;
+	int finished = job->finished; /* The last rows were handed over before this was set */
+	pthread_mutex_unlock(&job->lock);
+	if(rows > conf.index.n)
+	{
+		editorLoadAdd(rows, lo, hi);
+	}
+	if(finished)
+	{
+		int error = editorLoadEnd();
+		if(error)
+		{
+			errno = error;
+			errorHandling(conf.filename);
+		}
+	}
+}
+
+/* Waiting until the document has at least rows rows or the whole file is loaded, for moves past the loaded rows */
+void editorLoadWait(long long rows)
+{
+	editorLoadPoll();
+	while(conf.load && conf.numrows < rows)
+	{
+		struct loadJob *job = conf.load;
+		pthread_mutex_lock(&job->lock);
+		while(job->rows == conf.index.n && !job->finished)
+		{
+			pthread_cond_wait(&job->ready, &job->lock);
+		}
+		pthread_mutex_unlock(&job->lock);
+		editorLoadPoll();
+	}
+}
+
+/* Waiting for the rest of the file, before anything that works on the whole document */
+void editorLoadAll()
+{
+	editorLoadWait(LLONG_MAX);
+}
+
+/* Stopping the load of a buffer that is closed, the rows loaded so far go away with it */
+void editorLoadStop()
+{
+	if(conf.load)
+	{
+		__atomic_store_n(&conf.load->cancel, 1, __ATOMIC_RELAXED);
+		editorLoadEnd();
+	}
+}
+
+/* Loading a regular file by mapping it and pointing every row into the mapping. The loader thread finds the line
+ * boundaries, this returns as soon as the rows of the first screen are there and the rest are added as they come. */
+void editorOpenMapped(int fd, struct stat *st)
+{
+	size_t size = st->st_size;
+	char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		errorHandling("mmap");
+	}
+	conf.map = map;
+	conf.mapsize = size;
+	conf.map_dev = st->st_dev;
+	conf.map_ino = st->st_ino;
+
+	/* Other buffers that open the file use the mapping and the row index too, once it is complete */
+	struct fileMap *file = calloc(1, sizeof(struct fileMap));
+	file->refs = 1;
+	file->map = map;
+	file->size = size;
+	file->st = *st;
+	file->loading = 1;
+	file->next = conf.files;
+	conf.files = file;
+	conf.file = file;
+
+	struct loadJob *job = calloc(1, sizeof(struct loadJob));
+	job->map = map;
+	job->size = size;
+	job->converted_lo = INT_MAX;
+	job->rows_converted_lo = INT_MAX;
+	pthread_mutex_init(&job->lock, NULL);
+	pthread_cond_init(&job->ready, NULL);
+	conf.load = job;
+	job->threaded = pthread_create(&job->thread, NULL, editorLoadRun, job) == 0;
+	if(!job->threaded)
+	{
+		editorLoadRun(job);
+	}
+	editorLoadWait(conf.screenrows);
+}
+
+/* A file some buffer mapped that is still the same as the file st describes, NULL when there is none */
+struct fileMap *editorFileFind(struct stat *st)
+{
+	struct fileMap *file;
+	for(file = conf.files; file; file = file->next)
+	{
+		if(!file->loading && file->st.st_dev == st->st_dev && file->st.st_ino == st->st_ino && file->st.st_size == st->st_size &&
+		   file->st.st_mtim.tv_sec == st->st_mtim.tv_sec && file->st.st_mtim.tv_nsec == st->st_mtim.tv_nsec)
+		{
+			return file;
+		}
+	}
+	return NULL;
+}
+
+/* Loading a file another buffer has mapped, the rows are leaves over its row index and nothing is read or copied */
+void editorOpenShared(struct fileMap *file)
+{
+	file->refs++;
+	conf.file = file;
+	conf.map = file->map;
+	conf.mapsize = file->size;
+	conf.map_dev = file->st.st_dev;
+	conf.map_ino = file->st.st_ino;
+	conf.index = file->index;
+	long long i;
+	for(i = 0; i < file->index.n; i += ROW_LEAF_MAX)
+	{
+		rowLeaf *leaf = rowTreeNewLeaf(i);
+		leaf->n = file->index.n - i < ROW_LEAF_MAX ? file->index.n - i : ROW_LEAF_MAX;
+		rowTreeAppendLeaf(leaf);
+	}
+	conf.dirty_lo = file->converted_lo;
+	conf.dirty_hi = file->converted_hi;
+}
+
+/* A buffer is done with a mapped file, the last one unmaps it */
+void editorFileRelease(struct fileMap *file)
+{
+	if(--file->refs > 0)
+	{
+		return;
+	}
+	struct fileMap **p = &conf.files;
+	while(*p != file)
+	{
+		p = &(*p)->next;
+	}
+	*p = file->next;
+	munmap(file->map, file->size);
+	long long k;
+	for(k = 0; k < file->index.nblocks; k++)
+	{
+		free(file->index.blocks[k]);
+	}
+	free(file->index.blocks);
+	free(file);
+}
+
+/* Function for opening and reading given files */
+void editorOpen(char *filename)
+{
+	editorUndoReset();
+	conf.undo.paused++;
+	conf.journal.paused++;
+	free(conf.filename);
+	conf.filename = strdup(filename);
+
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1)
+	{
+		errorHandling("open");
+	}
+	struct stat st;
+	if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	{
+		conf.filestat = st;
+		conf.filestat_valid = 1;
+		if(st.st_size > 0)
+		{
+			editorMarkClean();
+			struct fileMap *file = editorFileFind(&st);
+			if(file)
+			{
+				editorOpenShared(file);
+			}else
+			{
+				editorOpenMapped(fd, &st);
+			}
+			close(fd); /* The mapping stays valid after the descriptor is closed */
+			conf.undo.paused--;
+			editorSelectSyntax();
+			/* The journal of the file belongs to the buffer that opened it first */
+			if(file)
+			{
+				return;
+			}
+			conf.journal.paused--;
+			editorJournalOpen();
+			return;
+		}
+	}
+
+	/* Pipes and other files that can't be mapped are read line by line */
+	FILE *file = fdopen(fd, "r");
+	if(file == NULL)
+	{
+		errorHandling("fdopen");
+	}
+	char *line = NULL; /* NULL is passed to line variable so it allocates brand new memory for every next line it reads */
+	size_t linecap = 0; 
+	ssize_t linelen;
+	/* Using while loops and conditions we can output multiple lines of text from user's file */
+	while ((linelen = getline(&line, &linecap, file)) != -1) {
+	    while (linelen > 0 && (line[linelen - 1] == '\n' ||
+        	                   line[linelen - 1] == '\r'))
+      		linelen--;
+    		editorInsertRow(conf.numrows, line, linelen);
+	
+	}
+  	free(line);
+  	fclose(file);
+  	editorMarkClean();
+	conf.undo.paused--;
+	conf.journal.paused--;
+	editorSelectSyntax();
+	editorJournalOpen();
+}
+
+/* Saving changes the user made*/
+void saveChanges()
+{
+	if(conf.save)
+	{
+		statusMessage("The last save is still running.");
+		return;
+	}
+	editorLoadAll(); /* The whole document is written */
+	/* If user opens a new file conf.filename will be NULL, we will output a prompt to user if that happens */
+	if(conf.filename == NULL)
+	{
+		conf.filename = editorPrompt("Save file as(ESC = cancel): %s", NULL);
+		if(conf.filename && conf.filename[0] == '\0')
+		{
+			free(conf.filename);
+			conf.filename = NULL;
+		}
+		/* If user pressed ESC, we output that save command was aborted*/
+		if(conf.filename == NULL)
+		{
+			statusMessage("Save canceled.");
+			return;
+		}
+		editorSelectSyntax();
+	}
+	/* The save may replace the followed file, what is appended to the old one doesn't belong to the saved one */
+	editorFollowStop();
+	long long start = perfNowNs();
+	struct saveJob *job = calloc(1, sizeof(struct saveJob));
+	/* Saving to the file a symlink points to, instead of replacing the link */
+	job->target = realpath(conf.filename, NULL);
+	if(job->target == NULL)
+	{
+		job->target = strdup(conf.filename);
+	}
+	editorSaveSnapshot(job);
+	/* Edits from here on are tracked against the file as this save leaves it */
+	conf.dirty_lo = INT_MAX;
+	conf.dirty_hi = 0;
+	conf.save = job;
+	if(job->mode == SAVE_INPLACE)
+	{
+		/* The edits have to be on disk before the file they apply to is written over, the journal is only dropped
+		 * once fdatasync of the write returned */
+		editorJournalFlush(1);
+	}else if(job->total > SIMPLR_BACKGROUND_SAVE)
+	{
+		job->threaded = 1;
+		if(pthread_create(&job->thread, NULL, editorSaveRun, job) == 0)
+		{
+			statusMessage("Saving in the background...");
+			perfRecord(PERF_SAVE, start);
+			return;
+		}
+		job->threaded = 0;
+	}
+	editorSaveRun(job);
+	editorSaveWait(1);
+	perfRecord(PERF_SAVE, start);
+}
+
+/* ====== BUFFER APPEND ======*/
+struct abuf
+{
+	char *b;
+	int len;
+	int cap;
+};
+#define ABUF_INIT {NULL, 0, 0}
+
+void abAppend(struct abuf *ab, const char *s, int len)
+{
+	if(len <= 0)
+	{
+		return;
+	}
+	perf.appends++;
+	perf.append_bytes += len;
+	/* The buffer grows geometrically, the screen is built from many small appends */
+	if(ab->len + len > ab->cap)
+	{
+		int newcap = ab->cap ? ab->cap * 2 : 128;
+		while(newcap < ab->len + len)
+		{
+			newcap *= 2;
+		}
+		char *new = realloc(ab->b, newcap);
+		if(new == NULL)
+		{
+			return;
+		}
+		ab->b = new;
+		ab->cap = newcap;
+	}
+	memcpy(&ab->b[ab->len], s, len);
+	ab->len += len;
+}
+
+void abFree(struct abuf *ab)
+{
+	free(ab->b);
+}
+
+/* ====== EDITOR OPERATIONS ======*/
+void editorInsertChar(int c)
+{
+	if(conf.cy  == conf.numrows)
+	{
+		editorInsertRow(conf.numrows, "", 0);
+	}
+	editorRowInsertChar(conf.cy, conf.cx, c);
+	conf.cx++;
+}
+
+/* Breaking row y in two at index x, recorded as one small record instead of the text that moves */
+void editorRowSplit(int y, int x)
+{
+	editorUndoRecord(UNDO_SPLIT, y, x, NULL, 0, NULL, 0);
+	editorJournalWrite(UNDO_SPLIT, y, x, 0, NULL, 0);
+	conf.undo.paused++;
+	conf.journal.paused++;
+	editor_row *row = editorRowAt(y);
+	editorInsertRow(y + 1, &editorRowFlatten(row)[x], row->size - x);
+	editorRowTruncate(y, x);
+	conf.undo.paused--;
+	conf.journal.paused--;
+}
+
+/* Appending row y + 1 to row y and deleting it */
+void editorRowJoin(int y)
+{
+	editorUndoRecord(UNDO_JOIN, y, editorRowAt(y)->size, NULL, 0, NULL, 0);
+	editorJournalWrite(UNDO_JOIN, y, 0, 0, NULL, 0);
+	conf.undo.paused++;
+	conf.journal.paused++;
+	editor_row *row = editorRowAt(y + 1);
+	editorRowAppendString(y, editorRowFlatten(row), row->size);
+	editorDeleteRow(y + 1);
+	conf.undo.paused--;
+	conf.journal.paused--;
+}
+
+void editorNewLine()
+{
+	if(conf.cx == 0)
+	{
+		editorInsertRow(conf.cy, "", 0);
+	}else
+	{
+		editorRowSplit(conf.cy, conf.cx);
+	}
+	conf.cy++;
+	conf.cx = 0;
+}
+
+/* Inserting a block of text at the cursor, line breaks in it start new rows */
+void editorInsertText(const char *s, size_t len)
+{
+	if(conf.cy == conf.numrows)
+	{
+		editorInsertRow(conf.numrows, "", 0);
+	}
+	const char *end = s + len;
+	const char *line = s;
+	const char *p;
+	for(p = s; p < end; p++)
+	{
+		if(*p != '\r' && *p != '\n')
+		{
+			continue;
+		}
+		editorRowInsertString(conf.cy, conf.cx, line, p - line);
+		conf.cx += p - line;
+		editorNewLine();
+		/* Terminals send a pasted line break as \r, but \r\n and \n are taken as one break too */
+		if(*p == '\r' && p + 1 < end && p[1] == '\n')
+		{
+			p++;
+		}
+		line = p + 1;
+	}
+	editorRowInsertString(conf.cy, conf.cx, line, end - line);
+	conf.cx += end - line;
+}
+
+void editorDelChar()
+{
+	if (conf.cy == conf.numrows) 
+	{
+		return;
+	}
+	/* If the cursor is in the beginning of a line, we return immediately*/
+	if(conf.cx == 0 && conf.cy == 0)
+	{
+		return;
+	}
+  	if (conf.cx > 0) {
+    		editorRowDeleteChar(conf.cy, conf.cx - 1);
+		conf.cx--;
+  	}else
+	{
+		conf.cx = editorRowAt(conf.cy - 1)->size;
+		editorRowJoin(conf.cy - 1);
+		conf.cy--;
+	}
+}
+
+/* ====== UNDO ======*/
+/* Every edit leaves a record in a journal that is kept as a stack in an arena of big blocks, so a long session
+ * doesn't scatter small allocations over the heap. Records hold only what changed, typing grows the newest
+ * record instead of adding one per key, and everything one command did is undone as one step. */
+size_t editorUndoSize(int textlen)
+{
+	return (sizeof(struct undoRecord) + textlen + 7) & ~(size_t)7;
+}
+
+void *editorUndoAlloc(size_t size)
+{
+	struct undoBlock *top = conf.undo.top;
+	if(top == NULL || top->cap - top->used < size)
+	{
+		size_t cap = size > SIMPLR_UNDO_BLOCK ? size : SIMPLR_UNDO_BLOCK;
+		struct undoBlock *block = malloc(sizeof(struct undoBlock) + cap);
+		block->prev = top;
+		block->used = 0;
+		block->cap = cap;
+		conf.undo.top = top = block;
+		conf.undo.bytes += cap;
+	}
+	void *p = top->data + top->used;
+	top->used += size;
+	return p;
+}
+
+/* Checking if a record lies in a block */
+int editorUndoInBlock(struct undoBlock *block, struct undoRecord *rec)
+{
+	return (char *)rec >= block->data && (char *)rec < block->data + block->cap;
+}
+
+/* Dropping the records that could still be redone, a new edit takes their place */
+void editorUndoDropRedo()
+{
+	struct undoRecord *current = conf.undo.current;
+	if(current == conf.undo.last)
+	{
+		return;
+	}
+	while(conf.undo.top && (current == NULL || !editorUndoInBlock(conf.undo.top, current)))
+	{
+		struct undoBlock *prev = conf.undo.top->prev;
+		conf.undo.bytes -= conf.undo.top->cap;
+		free(conf.undo.top);
+		conf.undo.top = prev;
+	}
+	if(current)
+	{
+		conf.undo.top->used = (char *)current + editorUndoSize(current->dellen + current->inslen) - conf.undo.top->data;
+		current->next = NULL;
+	}else
+	{
+		conf.undo.first = NULL;
+	}
+	conf.undo.last = current;
+}
+
+/* Forgetting every record, for a document that was just opened */
+void editorUndoReset()
+{
+	while(conf.undo.top)
+	{
+		struct undoBlock *prev = conf.undo.top->prev;
+		free(conf.undo.top);
+		conf.undo.top = prev;
+	}
+	conf.undo.first = conf.undo.last = conf.undo.current = NULL;
+	conf.undo.bytes = 0;
+}
+
+/* Growing the newest record by a typed or deleted character instead of adding a record for it.
+ * Only a record the previous command made on its own grows, and a new word starts a new record. */
+int editorUndoMerge(int y, int x, const char *del, int dellen, const char *ins, int inslen)
+{
+	struct undoRecord *rec = conf.undo.last;
+	struct undoBlock *top = conf.undo.top;
+	if(rec == NULL || rec != conf.undo.current || rec->type != UNDO_SPLICE || rec->y != y ||
+	   rec->group < conf.undo.group - 1 || (rec->prev && rec->prev->group == rec->group) ||
+	   !editorUndoInBlock(top, rec) || (char *)rec - top->data + editorUndoSize(rec->dellen + rec->inslen + 1) > top->cap)
+	{
+		return 0;
+	}
+	if(inslen == 1 && ins && dellen == 0 && rec->dellen == 0 && rec->x + rec->inslen == x)
+	{
+		if(isspace((unsigned char)ins[0]) && rec->inslen > 0 && !isspace((unsigned char)rec->text[rec->inslen - 1]))
+		{
+			return 0;
+		}
+		rec->text[rec->inslen++] = ins[0];
+	}else if(dellen == 1 && del && inslen == 0 && rec->inslen == 0 && rec->x == x + 1)
+	{
+		/* Backspace, the character goes in front of the ones deleted before */
+		memmove(rec->text + 1, rec->text, rec->dellen);
+		rec->text[0] = del[0];
+		rec->dellen++;
+		rec->x--;
+	}else if(dellen == 1 && del && inslen == 0 && rec->inslen == 0 && rec->x == x)
+	{
+		rec->text[rec->dellen++] = del[0];
+	}else
+	{
+		return 0;
+	}
+	rec->group = conf.undo.group;
+	top->used = (char *)rec + editorUndoSize(rec->dellen + rec->inslen) - top->data;
+	return 1;
+}
+
+/* Recording an edit, del or ins may be NULL when the caller copies the text into the record it gets back.
+ * Returns NULL when nothing needs filling in. */
+struct undoRecord *editorUndoRecord(int type, int y, int x, const char *del, int dellen, const char *ins, int inslen)
+{
+	if(conf.undo.paused)
+	{
+		return NULL;
+	}
+	editorUndoDropRedo();
+	if(type == UNDO_SPLICE && editorUndoMerge(y, x, del, dellen, ins, inslen))
+	{
+		return NULL;
+	}
+	struct undoRecord *rec = editorUndoAlloc(editorUndoSize(dellen + inslen));
+	rec->type = type;
+	rec->group = conf.undo.group;
+	rec->y = y;
+	rec->x = x;
+	rec->dellen = dellen;
+	rec->inslen = inslen;
+	if(del)
+	{
+		memcpy(rec->text, del, dellen);
+	}
+	if(ins)
+	{
+		memcpy(rec->text + dellen, ins, inslen);
+	}
+	rec->prev = conf.undo.last;
+	rec->next = NULL;
+	if(conf.undo.last)
+	{
+		conf.undo.last->next = rec;
+	}else
+	{
+		conf.undo.first = rec;
+	}
+	conf.undo.last = conf.undo.current = rec;
+	return rec;
+}
+
+/* Applying a record backwards with undo set or forwards again, and moving the cursor to where it happened.
+ * Rows changed by splices are gathered in [*lo, *hi) and marked dirty together. */
+void editorUndoApply(struct undoRecord *rec, int undo, int *lo, int *hi)
+{
+	char *del = rec->text;
+	char *ins = rec->text + rec->dellen;
+	if(rec->type == UNDO_SPLICE)
+	{
+		editorRowSplice(rec->y, rec->x, undo ? rec->inslen : rec->dellen,
+		                undo ? del : ins, undo ? rec->dellen : rec->inslen);
+		if(rec->y < *lo)
+		{
+			*lo = rec->y;
+		}
+		if(rec->y >= *hi)
+		{
+			*hi = rec->y + 1;
+		}
+		conf.cy = rec->y;
+		conf.cx = rec->x + (undo ? rec->dellen : rec->inslen);
+		return;
+	}
+	/* Rows are about to move, the ones changed so far are marked while their line numbers are still right */
+	if(*lo < *hi)
+	{
+		editorMarkDirty(*lo, *hi);
+		*lo = INT_MAX;
+		*hi = 0;
+	}
+	conf.cy = rec->y;
+	conf.cx = 0;
+	switch(rec->type)
+	{
+		case UNDO_SPLIT:
+		case UNDO_JOIN:
+			if((rec->type == UNDO_SPLIT) != undo)
+			{
+				editorRowSplit(rec->y, rec->x);
+			}else
+			{
+				editorRowJoin(rec->y);
+			}
+			conf.cx = rec->x;
+			break;
+		case UNDO_INSERT_ROW:
+			if(undo)
+			{
+				editorDeleteRow(rec->y);
+			}else
+			{
+				editorInsertRow(rec->y, ins, rec->inslen);
+			}
+			break;
+		case UNDO_DELETE_ROW:
+			if(undo)
+			{
+				editorInsertRow(rec->y, del, rec->dellen);
+			}else
+			{
+				editorDeleteRow(rec->y);
+			}
+			break;
+	}
+}
+
+/* Undoing the last command with dir -1, or redoing the next one with dir 1 */
+void editorUndoStep(int dir)
+{
+	struct undoRecord *rec = dir < 0 ? conf.undo.current : conf.undo.current ? conf.undo.current->next : conf.undo.first;
+	if(rec == NULL)
+	{
+		statusMessage(dir < 0 ? "Nothing to undo." : "Nothing to redo.");
+		return;
+	}
+	int group = rec->group;
+	int lo = INT_MAX, hi = 0;
+	conf.undo.paused++;
+	while(rec && rec->group == group)
+	{
+		editorUndoApply(rec, dir < 0, &lo, &hi);
+		conf.undo.current = dir < 0 ? rec->prev : rec;
+		rec = dir < 0 ? rec->prev : rec->next;
+	}
+	conf.undo.paused--;
+	if(lo < hi)
+	{
+		editorMarkDirty(lo, hi);
+	}
+	if(conf.cy > conf.numrows)
+	{
+		conf.cy = conf.numrows;
+	}
+	if(conf.cy < conf.numrows && conf.cx > editorRowAt(conf.cy)->size)
+	{
+		conf.cx = editorRowAt(conf.cy)->size;
+	}
+}
+
+/* ====== JOURNAL ======*/
+/* Every edit is appended to a journal next to the file as a small binary record, so the edits of a session that
+ * ends without saving survive it. Records are only gathered in memory while typing. The main loop hands them to
+ * a thread once per SIMPLR_JOURNAL_SYNC milliseconds, and the thread appends them as one frame and syncs the file.
+ * A frame starts with its length and a hash, so a frame cut off by a crash is recognised and dropped. The file
+ * starts with the identity of the file the edits apply to, and it is only replayed over that same file or over
+ * that file grown by appends. */
+#define JOURNAL_MAGIC "SIMPLRJ2"
+#define JOURNAL_HASH_INIT 2166136261u
+
+struct journalHeader
+{
+	char magic[8];
+	long long dev, ino, size;
+	long long mtime_sec, mtime_nsec;
+	long long followed; /* The file was followed, the journal also applies to it grown by appends */
+	long long prefix_hash; /* Hash of the first size bytes of a followed file, to recognise it once it grew */
+};
+
+void editorJournalHeader(struct journalHeader *h, struct stat *st)
+{
+	memset(h, 0, sizeof(*h));
+	memcpy(h->magic, JOURNAL_MAGIC, sizeof(h->magic));
+	h->dev = st->st_dev;
+	h->ino = st->st_ino;
+	h->size = st->st_size;
+	h->mtime_sec = st->st_mtim.tv_sec;
+	h->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/* Hashing len more bytes after the ones that gave hash, so the hash of a growing file is kept up to date */
+unsigned int editorJournalHashMore(unsigned int hash, const char *s, size_t len)
+{
+	size_t j;
+	for(j = 0; j < len; j++)
+	{
+		hash = (hash ^ (unsigned char)s[j]) * 16777619u;
+	}
+	return hash;
+}
+
+unsigned int editorJournalHash(const char *s, size_t len)
+{
+	return editorJournalHashMore(JOURNAL_HASH_INIT, s, len);
+}
+
+void editorJournalBytes(char **buf, size_t *len, size_t *cap, const char *s, size_t n)
+{
+	if(n == 0)
+	{
+		return;
+	}
+	if(*len + n > *cap)
+	{
+		*cap = *cap * 2 > *len + n ? *cap * 2 : *len + n + 4096;
+		*buf = realloc(*buf, *cap);
+	}
+	memcpy(*buf + *len, s, n);
+	*len += n;
+}
+
+/* Numbers are written 7 bits at a time, so the line and index of an edit usually take a few bytes */
+int editorJournalVarint(char *p, unsigned int v)
+{
+	int n = 0;
+	while(v >= 0x80)
+	{
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Appending an edit, the types are the ones of the undo records. For a splice, remove characters at y, x are
+ * replaced by ins. */
+void editorJournalWrite(int type, int y, int x, int remove, const char *ins, int inslen)
+{
+	struct editJournal *j = &conf.journal;
+	if(j->paused || j->path == NULL)
+	{
+		return;
+	}
+	char head[1 + 4 * 5];
+	int n = 0;
+	head[n++] = type;
+	n += editorJournalVarint(head + n, y);
+	n += editorJournalVarint(head + n, x);
+	n += editorJournalVarint(head + n, remove);
+	n += editorJournalVarint(head + n, inslen);
+	editorJournalBytes(&j->buf, &j->len, &j->cap, head, n);
+	editorJournalBytes(&j->buf, &j->len, &j->cap, ins, inslen);
+	if(conf.save)
+	{
+		editorJournalBytes(&j->carry, &j->carrylen, &j->carrycap, head, n);
+		editorJournalBytes(&j->carry, &j->carrylen, &j->carrycap, ins, inslen);
+	}
+}
+
+void *editorJournalRun(void *arg)
+{
+	struct journalBatch *batch = arg;
+	unsigned int frame[2] = {batch->len, editorJournalHash(batch->buf, batch->len)};
+	struct iovec iov[2] = {{frame, sizeof(frame)}, {batch->buf, batch->len}};
+	/* A batch without records only syncs a header that was written over */
+	if((batch->len > 0 && editorWritevAll(batch->fd, iov, 2, NULL) == -1) || fdatasync(batch->fd) == -1)
+	{
+		batch->error = errno;
+	}
+	__atomic_store_n(&batch->done, 1, __ATOMIC_RELEASE);
+	if(batch->threaded)
+	{
+		editorWake();
+	}
+	return NULL;
+}
+
+/* The identity of the file on disk the journal applies to, a followed file is also known by its hash */
+void editorJournalIdentity(struct journalHeader *h)
+{
+	editorJournalHeader(h, &conf.filestat);
+	if(conf.follow.active)
+	{
+		h->followed = 1;
+		h->prefix_hash = editorFollowHash();
+	}
+}
+
+/* Starting the journal file with the identity of the file on disk */
+int editorJournalCreate()
+{
+	struct editJournal *j = &conf.journal;
+	if(!conf.filestat_valid)
+	{
+		return -1;
+	}
+	int fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd == -1)
+	{
+		return -1;
+	}
+	struct journalHeader h;
+	editorJournalIdentity(&h);
+	struct iovec iov = {&h, sizeof(h)};
+	if(editorWritevAll(fd, &iov, 1, NULL) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	j->fd = fd;
+	return 0;
+}
+
+/* The followed file grew or started being followed, the header is written over so the journal keeps matching it.
+ * The next batch syncs the header, with records or without. */
+void editorJournalFollowed()
+{
+	struct editJournal *j = &conf.journal;
+	if(j->fd == -1)
+	{
+		return;
+	}
+	struct journalHeader h;
+	editorJournalIdentity(&h);
+	if(pwrite(j->fd, &h, sizeof(h), 0) != sizeof(h))
+	{
+		statusMessage("Couldn't write the journal: %s", strerror(errno));
+		return;
+	}
+	j->resync = 1;
+}
+
+/* Handing the gathered records to a thread that writes them, at most once per SIMPLR_JOURNAL_SYNC milliseconds.
+ * With block set they are written right away, and the call returns once they are on disk. */
+void editorJournalFlush(int block)
+{
+	struct editJournal *j = &conf.journal;
+	if(j->batch)
+	{
+		if(!block && !__atomic_load_n(&j->batch->done, __ATOMIC_ACQUIRE))
+		{
+			return;
+		}
+		if(j->batch->threaded)
+		{
+			pthread_join(j->batch->thread, NULL);
+		}
+		if(j->batch->error)
+		{
+			statusMessage("Couldn't write the journal: %s", strerror(j->batch->error));
+		}
+		free(j->batch->buf);
+		free(j->batch);
+		j->batch = NULL;
+	}
+	if((j->len == 0 && !j->resync) || (!block && editorNowMs() - j->flushed < SIMPLR_JOURNAL_SYNC))
+	{
+		return;
+	}
+	if(j->fd == -1 && editorJournalCreate() == -1)
+	{
+		j->len = 0; /* There is no place for the journal, editing goes on without it */
+		return;
+	}
+	struct journalBatch *batch = calloc(1, sizeof(struct journalBatch));
+	batch->fd = j->fd;
+	batch->buf = j->buf;
+	batch->len = j->len;
+	j->buf = NULL;
+	j->len = j->cap = 0;
+	j->resync = 0;
+	j->flushed = editorNowMs();
+	j->batch = batch;
+	/* The thread reads threaded when it is done, so it is set before the thread starts */
+	batch->threaded = !block;
+	if(batch->threaded && pthread_create(&batch->thread, NULL, editorJournalRun, batch) != 0)
+	{
+		batch->threaded = 0;
+	}
+	if(!batch->threaded)
+	{
+		editorJournalRun(batch);
+	}
+	if(block)
+	{
+		editorJournalFlush(0);
+	}
+}
+
+/* Milliseconds until the next batch of the journal is due, -1 when there is nothing to write */
+int editorJournalTimeout()
+{
+	if(conf.journal.len == 0 && !conf.journal.resync)
+	{
+		return -1;
+	}
+	long long ms = conf.journal.flushed + SIMPLR_JOURNAL_SYNC - editorNowMs();
+	return ms > 0 ? (int)ms : 0;
+}
+
+/* Throwing the journal away, the edits in it are saved or the user chose to drop them */
+void editorJournalDiscard()
+{
+	struct editJournal *j = &conf.journal;
+	if(j->batch)
+	{
+		editorJournalFlush(1);
+	}
+	if(j->fd != -1)
+	{
+		close(j->fd);
+		j->fd = -1;
+	}
+	if(j->path)
+	{
+		unlink(j->path);
+	}
+	j->len = 0;
+	j->resync = 0;
+}
+
+/* The journal of dir/name is the hidden file dir/.name.journal */
+void editorJournalSetPath()
+{
+	struct editJournal *j = &conf.journal;
+	free(j->path);
+	const char *slash = strrchr(conf.filename, '/');
+	int dirlen = slash ? slash - conf.filename + 1 : 0;
+	j->path = malloc(strlen(conf.filename) + 16);
+	sprintf(j->path, "%.*s.%s.journal", dirlen, conf.filename, conf.filename + dirlen);
+}
+
+/* A save finished, after a successful one the journal starts over with the edits made while it ran */
+void editorJournalSaved(int ok)
+{
+	struct editJournal *j = &conf.journal;
+	if(ok)
+	{
+		editorJournalDiscard();
+		if(j->path == NULL && conf.filename && !j->paused)
+		{
+			editorJournalSetPath();
+		}
+		char *buf = j->buf;
+		size_t cap = j->cap;
+		j->buf = j->carry;
+		j->len = j->carrylen;
+		j->cap = j->carrycap;
+		j->carry = buf;
+		j->carrycap = cap;
+	}
+	j->carrylen = 0;
+}
+
+/* Reading a number written by editorJournalVarint, returns NULL when it runs past end */
+const char *editorJournalReadVarint(const char *p, const char *end, int *v)
+{
+	unsigned int value = 0;
+	int shift = 0;
+	while(p < end && shift < 32)
+	{
+		unsigned char c = *p++;
+		value |= (unsigned int)(c & 0x7f) << shift;
+		if(!(c & 0x80))
+		{
+			*v = value;
+			return value > INT_MAX ? NULL : p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+/* Applying one frame of records, returns the number of edits or -1 when a record doesn't fit the document */
+long long editorJournalReplayFrame(const char *p, const char *end)
+{
+	long long edits = 0;
+	while(p < end)
+	{
+		int type = *p++;
+		int y, x, remove, inslen;
+		if((p = editorJournalReadVarint(p, end, &y)) == NULL || (p = editorJournalReadVarint(p, end, &x)) == NULL ||
+		   (p = editorJournalReadVarint(p, end, &remove)) == NULL ||
+		   (p = editorJournalReadVarint(p, end, &inslen)) == NULL || inslen > end - p)
+		{
+			return -1;
+		}
+		editor_row *row = y < conf.numrows ? editorRowAt(y) : NULL;
+		switch(type)
+		{
+			case UNDO_SPLICE:
+				if(row == NULL || x > row->size || remove > row->size - x)
+				{
+					return -1;
+				}
+				editorRowSplice(y, x, remove, p, inslen);
+				editorMarkDirty(y, y + 1);
+				break;
+			case UNDO_SPLIT:
+				if(row == NULL || x > row->size)
+				{
+					return -1;
+				}
+				editorRowSplit(y, x);
+				break;
+			case UNDO_JOIN:
+				if(y + 1 >= conf.numrows)
+				{
+					return -1;
+				}
+				editorRowJoin(y);
+				break;
+			case UNDO_INSERT_ROW:
+				if(y > conf.numrows)
+				{
+					return -1;
+				}
+				editorInsertRow(y, (char *)p, inslen);
+				break;
+			case UNDO_DELETE_ROW:
+				if(row == NULL)
+				{
+					return -1;
+				}
+				editorDeleteRow(y);
+				break;
+			default:
+				return -1;
+		}
+		p += inslen;
+		edits++;
+	}
+	return edits;
+}
+
+/* A journal applies to the file it was started over. The journal of a followed file also applies to that file grown
+ * by appends, when the part it knew of is still the same. Edits are recorded by row, so rows appended after the ones
+ * they touch don't move them. */
+int editorJournalMatches(struct journalHeader *h, struct journalHeader *want)
+{
+	if(memcmp(h, want, sizeof(*want)) == 0)
+	{
+		return 1;
+	}
+	if(memcmp(h->magic, want->magic, sizeof(h->magic)) != 0 || !h->followed || h->dev != want->dev ||
+	   h->ino != want->ino || h->size < 0 || h->size > want->size || (size_t)h->size > conf.mapsize)
+	{
+		return 0;
+	}
+	return editorJournalHash(conf.map, h->size) == (unsigned int)h->prefix_hash;
+}
+
+/* Setting up the journal of a file that was just opened, and replaying the one a crashed session left behind */
+void editorJournalOpen()
+{
+	struct editJournal *j = &conf.journal;
+	editorJournalDiscard();
+	free(j->path);
+	j->path = NULL;
+	if(!conf.filestat_valid)
+	{
+		return; /* Pipes and other files that can't be written back aren't journaled */
+	}
+	editorJournalSetPath();
+	int fd = open(j->path, O_RDWR);
+	if(fd == -1)
+	{
+		return;
+	}
+	struct stat st;
+	struct journalHeader want;
+	editorJournalHeader(&want, &conf.filestat);
+	char *map = MAP_FAILED;
+	if(fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(want))
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	if(map == MAP_FAILED || !editorJournalMatches((struct journalHeader *)map, &want))
+	{
+		if(map != MAP_FAILED)
+		{
+			munmap(map, st.st_size);
+		}
+		close(fd);
+		statusMessage("Ignoring %s, the file changed after it was written", j->path);
+		return;
+	}
+	editorLoadAll(); /* The edits may be anywhere in the file */
+	conf.journal.paused++;
+	conf.undo.paused++;
+	const char *p = map + sizeof(want);
+	const char *end = map + st.st_size;
+	long long edits = 0;
+	while(end - p >= 8)
+	{
+		unsigned int frame[2];
+		memcpy(frame, p, sizeof(frame));
+		if(frame[0] > (size_t)(end - p - 8) || editorJournalHash(p + 8, frame[0]) != frame[1])
+		{
+			break; /* The last frame was cut off */
+		}
+		long long n = editorJournalReplayFrame(p + 8, p + 8 + frame[0]);
+		if(n == -1)
+		{
+			break;
+		}
+		edits += n;
+		p += 8 + frame[0];
+	}
+	conf.journal.paused--;
+	conf.undo.paused--;
+	/* New frames go after the last good one */
+	if(ftruncate(fd, p - map) == 0 && lseek(fd, 0, SEEK_END) != -1)
+	{
+		j->fd = fd;
+	}else
+	{
+		close(fd);
+	}
+	munmap(map, st.st_size);
+	if(edits > 0)
+	{
+		statusMessage("Recovered %lld unsaved edits from %s", edits, j->path);
+	}
+}
+
+/* ====== WORKERS ======*/
+/* A pool with a thread per core runs long jobs over the rows in chunks. The main thread holds conf.rowlock for
+ * writing all the time except while it waits for events, a worker holds it for reading while it works on a chunk,
+ * so workers only ever see rows that aren't changing. */
+struct workJob
+{
+	void (*run)(struct workJob *job, int chunk); /* Does one chunk of the job */
+	void (*free)(struct workJob *job);
+	int nchunks;
+	int next; /* Next chunk to hand out */
+	int done; /* Chunks that are finished */
+	int cancel; /* Set by the main thread, chunks that aren't started yet are dropped */
+	int refs; /* The main thread and every worker busy with the job hold a reference, the last one frees it */
+	long long woke; /* When a worker last woke the main thread for this job */
+};
+
+struct workerPool
+{
+	pthread_mutex_t lock; /* Protects everything in here and the counters of the current job */
+	pthread_cond_t cond;
+	struct workJob *job; /* Job the workers take chunks from */
+	int nthreads;
+};
+
+struct workerPool workers = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0};
+
+long long editorNowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void editorWorkRelease(struct workJob *job)
+{
+	if(--job->refs == 0)
+	{
+		job->free(job);
+	}
+}
+
+void *editorWorker(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&workers.lock);
+	while(1)
+	{
+		struct workJob *job = workers.job;
+		if(job == NULL || job->next >= job->nchunks)
+		{
+			pthread_cond_wait(&workers.cond, &workers.lock);
+			continue;
+		}
+		int chunk = job->next++;
+		job->refs++;
+		pthread_mutex_unlock(&workers.lock);
+
+		pthread_rwlock_rdlock(&conf.rowlock);
+		/* The main thread cancels a job before it changes any row, and it does so while it holds the lock */
+		if(!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+		{
+			job->run(job, chunk);
+		}
+		pthread_rwlock_unlock(&conf.rowlock);
+
+		pthread_mutex_lock(&workers.lock);
+		job->done++;
+		/* Results are shown as they come in, but the screen isn't redrawn for every chunk */
+		long long now = editorNowMs();
+		if(!job->cancel && (job->done == job->nchunks || now - job->woke >= SIMPLR_WORK_REFRESH))
+		{
+			job->woke = now;
+			editorWake();
+		}
+		editorWorkRelease(job);
+	}
+	return NULL;
+}
+
+/* Handing a job to the workers, a job that still runs is canceled. The caller keeps a reference. */
+void editorWorkSubmit(struct workJob *job)
+{
+	pthread_mutex_lock(&workers.lock);
+	if(workers.nthreads == 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		int n = cores < 1 ? 1 : cores > SIMPLR_MAX_WORKERS ? SIMPLR_MAX_WORKERS : cores;
+		int j;
+		for(j = 0; j < n; j++)
+		{
+			pthread_t thread;
+			if(pthread_create(&thread, NULL, editorWorker, NULL) == 0)
+			{
+				pthread_detach(thread);
+				workers.nthreads++;
+			}
+		}
+	}
+	if(workers.job)
+	{
+		workers.job->cancel = 1;
+	}
+	job->next = job->done = job->cancel = 0;
+	job->refs = 2; /* One for the caller, one for the pool */
+	job->woke = editorNowMs();
+	if(workers.job)
+	{
+		editorWorkRelease(workers.job);
+	}
+	workers.job = job;
+	pthread_cond_broadcast(&workers.cond);
+	pthread_mutex_unlock(&workers.lock);
+}
+
+/* Stopping a job and dropping the caller's reference, the job may be freed right away */
+void editorWorkCancel(struct workJob *job)
+{
+	pthread_mutex_lock(&workers.lock);
+	__atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+	if(workers.job == job)
+	{
+		workers.job = NULL;
+		editorWorkRelease(job);
+	}
+	editorWorkRelease(job);
+	pthread_mutex_unlock(&workers.lock);
+}
+
+/* Reading how many chunks of a job are finished */
+int editorWorkDone(struct workJob *job)
+{
+	pthread_mutex_lock(&workers.lock);
+	int done = job->done;
+	pthread_mutex_unlock(&workers.lock);
+	return done;
+}
+
+/* ====== REGEX ======*/
+/* Regular expressions for search and replace. A pattern is parsed into a tree that is compiled into two Thompson
+ * NFAs, one for the pattern and one for the pattern read backwards. The NFAs run as DFAs whose states are built
+ * the first time they are reached, so matching is linear in the length of the line for every pattern.
+ * Supported are literals, ., [classes], \d \w \s and their negations, escapes, ^, $, groups, |, *, + and ?. */
+#define RE_SET 0
+#define RE_CAT 1
+#define RE_ALT 2
+#define RE_STAR 3
+#define RE_PLUS 4
+#define RE_QUEST 5
+#define RE_BOL 6
+#define RE_EOL 7
+#define RE_EMPTY 8
+
+struct regexNode
+{
+	int type;
+	struct regexNode *a, *b;
+	unsigned char set[32]; /* Bytes an RE_SET matches, a bit for each */
+};
+
+struct regexParser
+{
+	const char *p;
+	struct regexNode *nodes;
+	int nnodes;
+	int error;
+};
+
+void regexSetAdd(unsigned char *set, int c)
+{
+	set[(unsigned char)c >> 3] |= 1 << (c & 7);
+}
+
+int regexSetHas(const unsigned char *set, int c)
+{
+	return set[c >> 3] & (1 << (c & 7));
+}
+
+struct regexNode *regexNewNode(struct regexParser *ps, int type, struct regexNode *a, struct regexNode *b)
+{
+	struct regexNode *node = &ps->nodes[ps->nnodes++];
+	node->type = type;
+	node->a = a;
+	node->b = b;
+	memset(node->set, 0, sizeof(node->set));
+	return node;
+}
+
+/* Adding the bytes of a class escape like \d to set, returns 0 when c doesn't name a class */
+int regexClassEscape(unsigned char *set, int c)
+{
+	int j;
+	int negate = isupper(c);
+	unsigned char class[32] = {0};
+	switch(tolower(c))
+	{
+		case 'd':
+			for(j = '0'; j <= '9'; j++) regexSetAdd(class, j);
+			break;
+		case 'w':
+			for(j = 0; j < 256; j++) if(isalnum(j) || j == '_') regexSetAdd(class, j);
+			break;
+		case 's':
+			for(j = 0; j < 256; j++) if(isspace(j)) regexSetAdd(class, j);
+			break;
+		default:
+			return 0;
+	}
+	for(j = 0; j < 32; j++)
+	{
+		set[j] |= negate ? ~class[j] : class[j];
+	}
+	return 1;
+}
+
+int regexEscapeChar(int c)
+{
+	switch(c)
+	{
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		default: return c;
+	}
+}
+
+struct regexNode *regexParseAlt(struct regexParser *ps);
+
+/* Parsing a [class] after the opening bracket */
+struct regexNode *regexParseClass(struct regexParser *ps)
+{
+	struct regexNode *node = regexNewNode(ps, RE_SET, NULL, NULL);
+	int negate = 0;
+	if(*ps->p == '^')
+	{
+		negate = 1;
+		ps->p++;
+	}
+	int first = 1;
+	while(*ps->p && (*ps->p != ']' || first))
+	{
+		first = 0;
+		int c = (unsigned char)*ps->p++;
+		if(c == '\\' && *ps->p)
+		{
+			c = (unsigned char)*ps->p++;
+			if(regexClassEscape(node->set, c))
+			{
+				continue;
+			}
+			c = regexEscapeChar(c);
+		}
+		int last = c;
+		if(ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']')
+		{
+			last = (unsigned char)ps->p[1];
+			ps->p += 2;
+			if(last == '\\' && *ps->p)
+			{
+				last = regexEscapeChar((unsigned char)*ps->p++);
+			}
+		}
+		for(; c <= last; c++)
+		{
+			regexSetAdd(node->set, c);
+		}
+	}
+	if(*ps->p != ']')
+	{
+		ps->error = 1;
+		return node;
+	}
+	ps->p++;
+	if(negate)
+	{
+		int j;
+		for(j = 0; j < 32; j++)
+		{
+			node->set[j] = ~node->set[j];
+		}
+	}
+	return node;
+}
+
+struct regexNode *regexParseAtom(struct regexParser *ps)
+{
+	int c = (unsigned char)*ps->p++;
+	struct regexNode *node;
+	int j;
+	switch(c)
+	{
+		case '(':
+			node = regexParseAlt(ps);
+			if(*ps->p != ')')
+			{
+				ps->error = 1;
+				return node;
+			}
+			ps->p++;
+			return node;
+		case '[':
+			return regexParseClass(ps);
+		case '.':
+			node = regexNewNode(ps, RE_SET, NULL, NULL);
+			for(j = 0; j < 256; j++)
+			{
+				if(j != '\n')
+				{
+					regexSetAdd(node->set, j);
+				}
+			}
+			return node;
+		case '^':
+			return regexNewNode(ps, RE_BOL, NULL, NULL);
+		case '$':
+			return regexNewNode(ps, RE_EOL, NULL, NULL);
+		case '*':
+		case '+':
+		case '?':
+			ps->error = 1; /* Nothing to repeat */
+			return regexNewNode(ps, RE_EMPTY, NULL, NULL);
+		case '\\':
+			if(*ps->p == '\0')
+			{
+				ps->error = 1;
+				return regexNewNode(ps, RE_EMPTY, NULL, NULL);
+			}
+			c = (unsigned char)*ps->p++;
+			node = regexNewNode(ps, RE_SET, NULL, NULL);
+			if(!regexClassEscape(node->set, c))
+			{
+				regexSetAdd(node->set, regexEscapeChar(c));
+			}
+			return node;
+		default:
+			node = regexNewNode(ps, RE_SET, NULL, NULL);
+			regexSetAdd(node->set, c);
+			return node;
+	}
+}
+
+struct regexNode *regexParseRepeat(struct regexParser *ps)
+{
+	struct regexNode *node = regexParseAtom(ps);
+	while(*ps->p == '*' || *ps->p == '+' || *ps->p == '?')
+	{
+		int c = *ps->p++;
+		node = regexNewNode(ps, c == '*' ? RE_STAR : c == '+' ? RE_PLUS : RE_QUEST, node, NULL);
+	}
+	return node;
+}
+
+struct regexNode *regexParseCat(struct regexParser *ps)
+{
+	struct regexNode *node = NULL;
+	while(*ps->p && *ps->p != '|' && *ps->p != ')' && !ps->error)
+	{
+		struct regexNode *next = regexParseRepeat(ps);
+		node = node ? regexNewNode(ps, RE_CAT, node, next) : next;
+	}
+	return node ? node : regexNewNode(ps, RE_EMPTY, NULL, NULL);
+}
+
+struct regexNode *regexParseAlt(struct regexParser *ps)
+{
+	struct regexNode *node = regexParseCat(ps);
+	while(*ps->p == '|' && !ps->error)
+	{
+		ps->p++;
+		node = regexNewNode(ps, RE_ALT, node, regexParseCat(ps));
+	}
+	return node;
+}
+
+/* NFA states, the set and the assertion states lead to out, a split leads to out and out1 */
+#define NS_SET 0
+#define NS_SPLIT 1
+#define NS_BOL 2
+#define NS_EOL 3
+#define NS_MATCH 4
+
+struct regexState
+{
+	int type;
+	int out, out1;
+	unsigned char set[32];
+};
+
+struct regexNFA
+{
+	struct regexState *states;
+	int n, cap;
+	int start;
+};
+
+int regexAddState(struct regexNFA *nfa, int type, int out, int out1)
+{
+	if(nfa->n == nfa->cap)
+	{
+		nfa->cap = nfa->cap ? nfa->cap * 2 : 16;
+		nfa->states = realloc(nfa->states, sizeof(struct regexState) * nfa->cap);
+	}
+	struct regexState *st = &nfa->states[nfa->n];
+	st->type = type;
+	st->out = out;
+	st->out1 = out1;
+	return nfa->n++;
+}
+
+/* Compiling node so that it continues to state next, returns the state it starts at.
+ * With reverse the NFA matches the text read backwards. */
+int regexCompileNode(struct regexNFA *nfa, struct regexNode *node, int next, int reverse)
+{
+	int s, start;
+	switch(node->type)
+	{
+		case RE_SET:
+			s = regexAddState(nfa, NS_SET, next, -1);
+			memcpy(nfa->states[s].set, node->set, sizeof(node->set));
+			return s;
+		case RE_CAT:
+			if(reverse)
+			{
+				return regexCompileNode(nfa, node->b, regexCompileNode(nfa, node->a, next, reverse), reverse);
+			}
+			return regexCompileNode(nfa, node->a, regexCompileNode(nfa, node->b, next, reverse), reverse);
+		case RE_ALT:
+			start = regexCompileNode(nfa, node->a, next, reverse);
+			return regexAddState(nfa, NS_SPLIT, start, regexCompileNode(nfa, node->b, next, reverse));
+		case RE_STAR:
+			s = regexAddState(nfa, NS_SPLIT, -1, next);
+			start = regexCompileNode(nfa, node->a, s, reverse);
+			nfa->states[s].out = start;
+			return s;
+		case RE_PLUS:
+			s = regexAddState(nfa, NS_SPLIT, -1, next);
+			start = regexCompileNode(nfa, node->a, s, reverse);
+			nfa->states[s].out = start;
+			return start;
+		case RE_QUEST:
+			start = regexCompileNode(nfa, node->a, next, reverse);
+			return regexAddState(nfa, NS_SPLIT, start, next);
+		case RE_BOL:
+			return regexAddState(nfa, reverse ? NS_EOL : NS_BOL, next, -1);
+		case RE_EOL:
+			return regexAddState(nfa, reverse ? NS_BOL : NS_EOL, next, -1);
+		default:
+			return next;
+	}
+}
+
+/* A DFA state is the set of NFA states the scan can be in. Only the states that consume a byte, the match state
+ * and the end of line assertions that aren't passed yet are kept, the rest is followed right away. */
+struct dfaState
+{
+	struct dfaState *next[256]; /* Transitions that were taken before, NULL until then */
+	struct dfaState *chain; /* Next state in the same hash bucket */
+	struct dfaState *all; /* Next state built by the DFA */
+	int match; /* A match ends here */
+	int eolmatch; /* A match ends here when the line ends here */
+	unsigned int hash;
+	int n;
+	int set[];
+};
+
+#define REGEX_BUCKETS 1024
+
+struct regexDFA
+{
+	struct regexNFA *nfa;
+	int unanchored; /* The start state joins after every byte, so matches can start anywhere */
+	struct dfaState *buckets[REGEX_BUCKETS];
+	struct dfaState *all;
+	int count;
+	int epoch; /* Changes every time the states are thrown away */
+	struct dfaState *start[2]; /* Indexed by whether the scan starts at the beginning of a line */
+	int *list, *stack, *set, *scratch;
+	unsigned int *mark;
+	unsigned int gen;
+};
+
+struct regex
+{
+	struct regexNFA nfa[2]; /* The pattern and the pattern backwards */
+	int copy; /* A copy for another thread shares the NFAs of the original */
+	struct regexDFA fwd; /* Anchored, finds where a match that starts at a given index ends */
+	struct regexDFA rev; /* Unanchored and backwards, finds every index a match starts at */
+};
+
+void regexDFAInit(struct regexDFA *dfa, struct regexNFA *nfa, int unanchored)
+{
+	memset(dfa, 0, sizeof(*dfa));
+	dfa->nfa = nfa;
+	dfa->unanchored = unanchored;
+	dfa->list = malloc(sizeof(int) * (nfa->n + 1));
+	dfa->stack = malloc(sizeof(int) * (3 * nfa->n + 2));
+	dfa->set = malloc(sizeof(int) * (nfa->n + 1));
+	dfa->scratch = malloc(sizeof(int) * (nfa->n + 1));
+	dfa->mark = calloc(nfa->n, sizeof(unsigned int));
+}
+
+void regexDFAFlush(struct regexDFA *dfa)
+{
+	while(dfa->all)
+	{
+		struct dfaState *next = dfa->all->all;
+		free(dfa->all);
+		dfa->all = next;
+	}
+	memset(dfa->buckets, 0, sizeof(dfa->buckets));
+	dfa->start[0] = dfa->start[1] = NULL;
+	dfa->count = 0;
+	dfa->epoch++;
+}
+
+void regexDFAFree(struct regexDFA *dfa)
+{
+	regexDFAFlush(dfa);
+	free(dfa->list);
+	free(dfa->stack);
+	free(dfa->set);
+	free(dfa->scratch);
+	free(dfa->mark);
+}
+
+int regexIntCompare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Following the states in dfa->list without consuming a byte, the kept states go to out sorted.
+ * Returns how many there are, *match tells if the match state was reached. */
+int regexClosure(struct regexDFA *dfa, int n, int bol, int eol, int *out, int *match)
+{
+	struct regexState *states = dfa->nfa->states;
+	int nout = 0;
+	int sp = 0;
+	int j;
+	*match = 0;
+	if(++dfa->gen == 0)
+	{
+		memset(dfa->mark, 0, sizeof(unsigned int) * dfa->nfa->n);
+		dfa->gen = 1;
+	}
+	for(j = 0; j < n; j++)
+	{
+		dfa->stack[sp++] = dfa->list[j];
+	}
+	while(sp > 0)
+	{
+		int s = dfa->stack[--sp];
+		if(dfa->mark[s] == dfa->gen)
+		{
+			continue;
+		}
+		dfa->mark[s] = dfa->gen;
+		struct regexState *st = &states[s];
+		switch(st->type)
+		{
+			case NS_SPLIT:
+				dfa->stack[sp++] = st->out1;
+				dfa->stack[sp++] = st->out;
+				break;
+			case NS_BOL:
+				if(bol)
+				{
+					dfa->stack[sp++] = st->out;
+				}
+				break;
+			case NS_EOL:
+				if(eol)
+				{
+					dfa->stack[sp++] = st->out;
+				}else
+				{
+					out[nout++] = s;
+				}
+				break;
+			case NS_MATCH:
+				*match = 1;
+				out[nout++] = s;
+				break;
+			default:
+				out[nout++] = s;
+		}
+	}
+	qsort(out, nout, sizeof(int), regexIntCompare);
+	return nout;
+}
+
+/* Finding the DFA state for a set of NFA states, it is built when it doesn't exist yet */
+struct dfaState *regexIntern(struct regexDFA *dfa, int *set, int n, int match)
+{
+	unsigned int hash = 2166136261u;
+	int j;
+	for(j = 0; j < n; j++)
+	{
+		hash = (hash ^ set[j]) * 16777619u;
+	}
+	struct dfaState *s;
+	for(s = dfa->buckets[hash % REGEX_BUCKETS]; s; s = s->chain)
+	{
+		if(s->hash == hash && s->n == n && memcmp(s->set, set, sizeof(int) * n) == 0)
+		{
+			return s;
+		}
+	}
+	/* A pattern that keeps building new states gets a fresh cache instead of growing without bounds */
+	if(dfa->count >= SIMPLR_REGEX_STATES)
+	{
+		regexDFAFlush(dfa);
+	}
+	s = calloc(1, sizeof(struct dfaState) + sizeof(int) * n);
+	s->hash = hash;
+	s->n = n;
+	memcpy(s->set, set, sizeof(int) * n);
+	s->match = match;
+	/* Passing the end of line assertions tells if a match ends here when the line does */
+	memcpy(dfa->list, set, sizeof(int) * n);
+	regexClosure(dfa, n, 0, 1, dfa->scratch, &s->eolmatch);
+	s->chain = dfa->buckets[hash % REGEX_BUCKETS];
+	dfa->buckets[hash % REGEX_BUCKETS] = s;
+	s->all = dfa->all;
+	dfa->all = s;
+	dfa->count++;
+	return s;
+}
+
+struct dfaState *regexStart(struct regexDFA *dfa, int bol)
+{
+	if(dfa->start[bol] == NULL)
+	{
+		int match;
+		dfa->list[0] = dfa->nfa->start;
+		int n = regexClosure(dfa, 1, bol, 0, dfa->set, &match);
+		struct dfaState *s = regexIntern(dfa, dfa->set, n, match);
+		dfa->start[bol] = s;
+	}
+	return dfa->start[bol];
+}
+
+struct dfaState *regexStep(struct regexDFA *dfa, struct dfaState *s, unsigned char c)
+{
+	if(s->next[c])
+	{
+		return s->next[c];
+	}
+	struct regexState *states = dfa->nfa->states;
+	int n = 0;
+	int j;
+	for(j = 0; j < s->n; j++)
+	{
+		struct regexState *st = &states[s->set[j]];
+		if(st->type == NS_SET && regexSetHas(st->set, c))
+		{
+			dfa->list[n++] = st->out;
+		}
+	}
+	if(dfa->unanchored)
+	{
+		dfa->list[n++] = dfa->nfa->start;
+	}
+	int match;
+	n = regexClosure(dfa, n, 0, 0, dfa->set, &match);
+	int epoch = dfa->epoch;
+	struct dfaState *next = regexIntern(dfa, dfa->set, n, match);
+	if(epoch == dfa->epoch)
+	{
+		s->next[c] = next;
+	}
+	return next;
+}
+
+/* Compiling a pattern, returns NULL when it isn't a valid regular expression */
+struct regex *regexCompile(const char *pattern)
+{
+	struct regexParser ps;
+	ps.p = pattern;
+	ps.nodes = malloc(sizeof(struct regexNode) * (2 * strlen(pattern) + 2));
+	ps.nnodes = 0;
+	ps.error = 0;
+	struct regexNode *root = regexParseAlt(&ps);
+	if(ps.error || *ps.p != '\0')
+	{
+		free(ps.nodes);
+		return NULL;
+	}
+	struct regex *re = calloc(1, sizeof(struct regex));
+	int k;
+	for(k = 0; k < 2; k++)
+	{
+		int match = regexAddState(&re->nfa[k], NS_MATCH, -1, -1);
+		re->nfa[k].start = regexCompileNode(&re->nfa[k], root, match, k);
+	}
+	free(ps.nodes);
+	regexDFAInit(&re->fwd, &re->nfa[0], 0);
+	regexDFAInit(&re->rev, &re->nfa[1], 1);
+	return re;
+}
+
+/* A copy with DFAs of its own, for a thread that matches at the same time as the original */
+struct regex *regexCopy(struct regex *re)
+{
+	struct regex *copy = calloc(1, sizeof(struct regex));
+	copy->nfa[0] = re->nfa[0];
+	copy->nfa[1] = re->nfa[1];
+	copy->copy = 1;
+	regexDFAInit(&copy->fwd, &copy->nfa[0], 0);
+	regexDFAInit(&copy->rev, &copy->nfa[1], 1);
+	return copy;
+}
+
+void regexFree(struct regex *re)
+{
+	if(re == NULL)
+	{
+		return;
+	}
+	regexDFAFree(&re->fwd);
+	regexDFAFree(&re->rev);
+	if(!re->copy)
+	{
+		free(re->nfa[0].states);
+		free(re->nfa[1].states);
+	}
+	free(re);
+}
+
+/* Running the backwards pattern over a row from its end down to index stop, which finds every index a match starts
+ * at on the way. Returns the lowest of them, or with upto set the first one found that is at most upto.
+ * Every start is counted in *count and marked in marks when they aren't NULL. Returns -1 when there is none. */
+int regexRowStarts(struct regex *re, editor_row *row, int stop, int upto, int *count, unsigned char *marks)
+{
+	struct regexDFA *dfa = &re->rev;
+	char *a = row->chars;
+	char *b = row->chars + row->gap + row->cap - row->size;
+	int gap = row->gap;
+	struct dfaState *s = regexStart(dfa, 1);
+	int best = -1;
+	int p = row->size;
+	while(1)
+	{
+		/* The backwards pattern sees the beginning of the line as its end */
+		if(s->match || (p == 0 && s->eolmatch))
+		{
+			if(count)
+			{
+				(*count)++;
+			}
+			if(marks)
+			{
+				marks[p] = 1;
+			}
+			best = p;
+			if(upto != -1 && p <= upto)
+			{
+				return p;
+			}
+		}
+		if(p <= stop)
+		{
+			break;
+		}
+		p--;
+		s = regexStep(dfa, s, (unsigned char)(p < gap ? a[p] : b[p - gap]));
+	}
+	return upto != -1 ? -1 : best;
+}
+
+/* Length of the longest match that starts at index at of a row */
+int regexRowMatchLen(struct regex *re, editor_row *row, int at)
+{
+	struct regexDFA *dfa = &re->fwd;
+	struct dfaState *s = regexStart(dfa, at == 0);
+	int best = at;
+	int p = at;
+	while(1)
+	{
+		if(s->match || (p == row->size && s->eolmatch))
+		{
+			best = p;
+		}
+		if(p == row->size || s->n == 0)
+		{
+			break;
+		}
+		s = regexStep(dfa, s, (unsigned char)editorRowChar(row, p));
+		p++;
+	}
+	return best - at;
+}
+
+/* ====== SEARCH ======*/
+/* A search term, kept in a structure so the other kinds of searches can grow out of it */
+struct searchQuery
+{
+	const char *needle;
+	int len;
+	struct regex *re; /* Compiled pattern when needle is a regular expression, NULL for plain text */
+};
+
+void searchCompile(struct searchQuery *q, const char *needle, int len)
+{
+	q->needle = needle;
+	q->len = len;
+	q->re = NULL;
+}
+
+/* Compiling a regular expression search, returns -1 when the pattern isn't valid */
+int searchCompileRegex(struct searchQuery *q, const char *pattern)
+{
+	searchCompile(q, pattern, strlen(pattern));
+	q->re = regexCompile(pattern);
+	return q->re ? 0 : -1;
+}
+
+void searchFree(struct searchQuery *q)
+{
+	regexFree(q->re);
+	q->re = NULL;
+}
+
+/* Finding the first match that lies completely inside [s, end) */
+const char *searchForward(struct searchQuery *q, const char *s, const char *end)
+{
+	if(end - s < q->len)
+	{
+		return NULL;
+	}
+	if(q->len == 1)
+	{
+		return memchr(s, q->needle[0], end - s);
+	}
+	return scanFind(s, end - s, q->needle, q->len);
+}
+
+/* Finding the last match that lies completely inside [s, end) */
+const char *searchBackward(struct searchQuery *q, const char *s, const char *end)
+{
+	if(end - s < q->len)
+	{
+		return NULL;
+	}
+	if(q->len == 1)
+	{
+		return memrchr(s, q->needle[0], end - s);
+	}
+	return scanFindLast(s, end - s, q->needle, q->len);
+}
+
+/* Checking for a match at index at of a row, when it may reach over the gap */
+int editorRowMatchAt(struct searchQuery *q, editor_row *row, int at)
+{
+	int j;
+	for(j = 0; j < q->len; j++)
+	{
+		if(editorRowChar(row, at + j) != q->needle[j])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Finding the first match in a row that starts at from or later with dir 1, or the last one that starts at from or
+ * earlier with dir -1. The text before and after the gap is searched as it is, only the matches over the gap are
+ * checked one by one. Returns the index of the match or -1. */
+int editorRowFind(struct searchQuery *q, editor_row *row, int from, int dir)
+{
+	if(q->re)
+	{
+		if(dir > 0)
+		{
+			return from > row->size ? -1 : regexRowStarts(q->re, row, from < 0 ? 0 : from, -1, NULL, NULL);
+		}
+		return from < 0 ? -1 : regexRowStarts(q->re, row, 0, from < row->size ? from : row->size, NULL, NULL);
+	}
+	char *a = row->chars;
+	int alen = row->gap;
+	char *b = row->chars + row->gap + row->cap - row->size;
+	int blen = row->size - row->gap;
+	const char *hit;
+	int j;
+	if(dir > 0)
+	{
+		if(from < 0)
+		{
+			from = 0;
+		}
+		if(from < alen && (hit = searchForward(q, a + from, a + alen)) != NULL)
+		{
+			return hit - a;
+		}
+		for(j = from > alen - q->len + 1 ? from : alen - q->len + 1; j < alen && j + q->len <= row->size; j++)
+		{
+			if(j >= 0 && editorRowMatchAt(q, row, j))
+			{
+				return j;
+			}
+		}
+		int bfrom = from > alen ? from - alen : 0;
+		if(bfrom < blen && (hit = searchForward(q, b + bfrom, b + blen)) != NULL)
+		{
+			return alen + (hit - b);
+		}
+		return -1;
+	}
+	if(from > row->size - q->len)
+	{
+		from = row->size - q->len;
+	}
+	if(from < 0)
+	{
+		return -1;
+	}
+	if(from >= alen && (hit = searchBackward(q, b, b + (from - alen) + q->len)) != NULL)
+	{
+		return alen + (hit - b);
+	}
+	for(j = from < alen - 1 ? from : alen - 1; j > alen - q->len && j >= 0; j--)
+	{
+		if(editorRowMatchAt(q, row, j))
+		{
+			return j;
+		}
+	}
+	int aend = from + q->len < alen ? from + q->len : alen;
+	if((hit = searchBackward(q, a, a + aend)) != NULL)
+	{
+		return hit - a;
+	}
+	return -1;
+}
+
+/* Rows of a leaf from j on that still point into the mapping in document order, so the mapping between the first of
+ * them and the end of the last one can be searched in one go. Returns the index of the last row of the run. */
+int editorMappedRunEnd(rowLeaf *leaf, int j, int dir)
+{
+	int k = j;
+	if(leaf->rows == NULL)
+	{
+		return dir > 0 ? leaf->n - 1 : 0; /* A leaf only in the row index is one run */
+	}
+	if(dir > 0)
+	{
+		while(k + 1 < leaf->n && (leaf->rows[k + 1].flags & ROW_MAPPED) &&
+		      leaf->rows[k + 1].chars >= leaf->rows[k].chars + leaf->rows[k].size)
+		{
+			k++;
+		}
+	}else
+	{
+		while(k - 1 >= 0 && (leaf->rows[k - 1].flags & ROW_MAPPED) &&
+		      leaf->rows[k].chars >= leaf->rows[k - 1].chars + leaf->rows[k - 1].size)
+		{
+			k--;
+		}
+	}
+	return k;
+}
+
+/* The row of the run [lo, hi] a match in the mapping falls into, -1 when it lies between rows or reaches past one */
+int editorMappedRunRow(struct searchQuery *q, rowLeaf *leaf, int lo, int hi, const char *hit)
+{
+	while(lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if(rowLeafChars(leaf, mid) <= hit)
+		{
+			lo = mid;
+		}else
+		{
+			hi = mid - 1;
+		}
+	}
+	char *chars = rowLeafChars(leaf, lo);
+	return hit >= chars && hit + q->len <= chars + rowLeafSize(leaf, lo) ? lo : -1;
+}
+
+/* Searching from line y, index x to the end of the document with dir 1, or back to its start with dir -1.
+ * Returns 1 and the position of the match in *matchy and *matchx when there is one. */
+int editorFindFrom(struct searchQuery *q, int y, int x, int dir, int *matchy, int *matchx)
+{
+	if(y < 0 || y >= conf.numrows || q->len == 0)
+	{
+		return 0;
+	}
+	int base = 0;
+	rowLeaf *leaf = rowTreeDescend(y, &base, 0);
+	int j = y - base;
+	editor_row view;
+	int at = editorRowFind(q, rowLeafView(leaf, j, &view), x, dir);
+	while(at == -1)
+	{
+		j += dir;
+		if(j < 0 || j >= leaf->n)
+		{
+			leaf = dir > 0 ? leaf->next : leaf->prev;
+			if(leaf == NULL)
+			{
+				return 0;
+			}
+			base += dir > 0 ? leaf->prev->n : -leaf->n;
+			j = dir > 0 ? 0 : leaf->n - 1;
+		}
+		/* Patterns are matched row by row, plain text is searched in whole runs of the mapping */
+		if(q->re || !rowLeafMapped(leaf, j))
+		{
+			at = editorRowFind(q, rowLeafView(leaf, j, &view), dir > 0 ? 0 : INT_MAX, dir);
+			continue;
+		}
+		/* Newlines can't be part of a term, so a match in the mapping lies inside one line */
+		int k = editorMappedRunEnd(leaf, j, dir);
+		int lo = dir > 0 ? j : k;
+		int hi = dir > 0 ? k : j;
+		const char *start = rowLeafChars(leaf, lo);
+		const char *end = rowLeafChars(leaf, hi) + rowLeafSize(leaf, hi);
+		const char *hit;
+		while((hit = dir > 0 ? searchForward(q, start, end) : searchBackward(q, start, end)) != NULL)
+		{
+			int r = editorMappedRunRow(q, leaf, lo, hi, hit);
+			if(r != -1)
+			{
+				j = r;
+				at = hit - rowLeafChars(leaf, r);
+				break;
+			}
+			/* A match in text that was cut off or deleted, the search goes on past it */
+			if(dir > 0)
+			{
+				start = hit + 1;
+			}else
+			{
+				end = hit + q->len - 1;
+			}
+		}
+		if(at == -1)
+		{
+			j = k;
+		}
+	}
+	*matchy = base + j;
+	*matchx = at;
+	return 1;
+}
+
+/* Counting the matches in rows [from, to), rows are only read so workers can count side by side */
+int editorCountMatches(struct searchQuery *q, int from, int to)
+{
+	if(from >= to || q->len == 0)
+	{
+		return 0;
+	}
+	int n = 0;
+	int base = 0;
+	rowLeaf *leaf = rowTreeDescend(from, &base, 0);
+	int j = from - base;
+	int y = from;
+	editor_row view;
+	while(y < to)
+	{
+		if(j == leaf->n)
+		{
+			leaf = leaf->next;
+			j = 0;
+		}
+		editor_row *row = rowLeafView(leaf, j, &view);
+		if(q->re)
+		{
+			/* One backwards pass finds every index a match starts at */
+			regexRowStarts(q->re, row, 0, -1, &n, NULL);
+			j++;
+			y++;
+			continue;
+		}
+		if(!(row->flags & ROW_MAPPED))
+		{
+			int at = editorRowFind(q, row, 0, 1);
+			while(at != -1)
+			{
+				n++;
+				at = editorRowFind(q, row, at + 1, 1);
+			}
+			j++;
+			y++;
+			continue;
+		}
+		int k = editorMappedRunEnd(leaf, j, 1);
+		if(k - j >= to - y)
+		{
+			k = j + (to - y) - 1;
+		}
+		/* The hits come in order, so the row each one falls into is found by walking forward */
+		const char *start = row->chars;
+		const char *end = rowLeafChars(leaf, k) + rowLeafSize(leaf, k);
+		const char *hit;
+		int r = j;
+		while((hit = searchForward(q, start, end)) != NULL)
+		{
+			while(r < k && rowLeafChars(leaf, r + 1) <= hit)
+			{
+				r++;
+			}
+			if(hit + q->len <= rowLeafChars(leaf, r) + rowLeafSize(leaf, r))
+			{
+				n++;
+			}
+			start = hit + 1;
+		}
+		y += k - j + 1;
+		j = k + 1;
+	}
+	return n;
+}
+
+/* Counting every match of the search term on the workers, so the status bar can tell which one the cursor is on */
+struct countJob
+{
+	struct workJob work;
+	struct searchQuery q;
+	char *term;
+	int numrows;
+	int *counts; /* Matches in each chunk of SIMPLR_SEARCH_CHUNK rows, -1 until a worker has counted them */
+	int match_y, match_x; /* Match the cursor is on, -1 when there is none */
+	int before_y, before_x; /* Match the number of earlier matches was counted for */
+	long long before;
+};
+
+void editorCountRun(struct workJob *work, int chunk)
+{
+	struct countJob *job = (struct countJob *)work;
+	int from = chunk * SIMPLR_SEARCH_CHUNK;
+	int to = from + SIMPLR_SEARCH_CHUNK < job->numrows ? from + SIMPLR_SEARCH_CHUNK : job->numrows;
+	struct searchQuery q = job->q;
+	/* The DFAs of a pattern grow while it matches, so every chunk matches with DFAs of its own */
+	if(q.re)
+	{
+		q.re = regexCopy(job->q.re);
+	}
+	__atomic_store_n(&job->counts[chunk], editorCountMatches(&q, from, to), __ATOMIC_RELEASE);
+	if(q.re)
+	{
+		regexFree(q.re);
+	}
+}
+
+void editorCountFree(struct workJob *work)
+{
+	struct countJob *job = (struct countJob *)work;
+	searchFree(&job->q);
+	free(job->counts);
+	free(job->term);
+	free(job);
+}
+
+void editorSearchCountStop()
+{
+	if(conf.search)
+	{
+		editorWorkCancel(&conf.search->work);
+		conf.search = NULL;
+	}
+}
+
+void editorSearchCountStart(const char *term, int regex)
+{
+	editorSearchCountStop();
+	if(term[0] == '\0')
+	{
+		return;
+	}
+	struct countJob *job = calloc(1, sizeof(struct countJob));
+	job->term = strdup(term);
+	if(!regex)
+	{
+		searchCompile(&job->q, job->term, strlen(job->term));
+	}else if(searchCompileRegex(&job->q, job->term) == -1)
+	{
+		free(job->term);
+		free(job);
+		return;
+	}
+	job->numrows = conf.numrows;
+	job->work.run = editorCountRun;
+	job->work.free = editorCountFree;
+	job->work.nchunks = (conf.numrows + SIMPLR_SEARCH_CHUNK - 1) / SIMPLR_SEARCH_CHUNK;
+	job->counts = malloc(sizeof(int) * (job->work.nchunks + 1));
+	memset(job->counts, -1, sizeof(int) * (job->work.nchunks + 1));
+	job->match_y = -1;
+	job->before_y = -1;
+	conf.search = job;
+	editorWorkSubmit(&job->work);
+}
+
+/* Writing "match N of M" for the status bar while a search is counted, M grows while the workers count */
+int editorSearchStatus(char *buf, int size)
+{
+	struct countJob *job = conf.search;
+	if(job == NULL)
+	{
+		return 0;
+	}
+	int done = editorWorkDone(&job->work) == job->work.nchunks;
+	long long total = 0;
+	int chunk;
+	for(chunk = 0; chunk < job->work.nchunks; chunk++)
+	{
+		int n = __atomic_load_n(&job->counts[chunk], __ATOMIC_ACQUIRE);
+		total += n > 0 ? n : 0;
+	}
+	if(job->match_y == -1)
+	{
+		return snprintf(buf, size, done ? "no matches" : "searching...");
+	}
+	/* The number of the match is known once every chunk before it is counted */
+	if(job->before_y != job->match_y || job->before_x != job->match_x)
+	{
+		int last = job->match_y / SIMPLR_SEARCH_CHUNK;
+		long long before = 0;
+		for(chunk = 0; chunk < last; chunk++)
+		{
+			int n = __atomic_load_n(&job->counts[chunk], __ATOMIC_ACQUIRE);
+			if(n < 0)
+			{
+				break;
+			}
+			before += n;
+		}
+		if(chunk < last)
+		{
+			return snprintf(buf, size, "match ? of %lld+", total);
+		}
+		before += editorCountMatches(&job->q, last * SIMPLR_SEARCH_CHUNK, job->match_y);
+		editor_row *row = editorRowAt(job->match_y);
+		int at = editorRowFind(&job->q, row, 0, 1);
+		while(at != -1 && at <= job->match_x)
+		{
+			before++;
+			at = editorRowFind(&job->q, row, at + 1, 1);
+		}
+		job->before = before;
+		job->before_y = job->match_y;
+		job->before_x = job->match_x;
+	}
+	return snprintf(buf, size, "match %lld of %lld%s", job->before, total, done ? "" : "+");
+}
+
+/* Called by the prompt after every key, moving the cursor to the match for what is typed so far.
+ * Arrow keys jump to the next or the previous match. */
+void editorFindStep(char *query, int key, int regex)
+{
+	static int last_y = -1, last_x = 0;
+	static int direction = 1;
+	if(key == '\r' || key == '\x1b')
+	{
+		last_y = -1;
+		direction = 1;
+		editorSearchCountStop();
+		return;
+	}else if(key == RIGHT || key == DOWN)
+	{
+		direction = 1;
+	}else if(key == LEFT || key == UP)
+	{
+		direction = -1;
+	}else
+	{
+		/* The term changed, the search starts again from the cursor and may match right there */
+		last_y = -1;
+		direction = 1;
+		editorSearchCountStart(query, regex);
+	}
+
+	struct searchQuery q;
+	if(!regex)
+	{
+		searchCompile(&q, query, strlen(query));
+	}else if(searchCompileRegex(&q, query) == -1)
+	{
+		/* Half typed patterns like "(a" don't match anything yet */
+		return;
+	}
+	int y = conf.cy, x = conf.cx;
+	if(last_y != -1)
+	{
+		y = last_y;
+		x = last_x + direction;
+	}
+	if(y >= conf.numrows)
+	{
+		y = 0;
+		x = 0;
+	}
+	int matchy, matchx;
+	int found = editorFindFrom(&q, y, x, direction, &matchy, &matchx);
+	if(!found)
+	{
+		/* Going on from the other end of the document */
+		found = direction > 0 ? editorFindFrom(&q, 0, 0, 1, &matchy, &matchx)
+		                      : editorFindFrom(&q, conf.numrows - 1, INT_MAX, -1, &matchy, &matchx);
+	}
+	if(found)
+	{
+		last_y = matchy;
+		last_x = matchx;
+		conf.cy = matchy;
+		conf.cx = matchx;
+		conf.rowoff = conf.numrows; /* Scrolling so the match ends up on the top line */
+	}
+	if(conf.search)
+	{
+		conf.search->match_y = found ? matchy : -1;
+		conf.search->match_x = matchx;
+	}
+	searchFree(&q);
+}
+
+void editorFindCallback(char *query, int key)
+{
+	editorFindStep(query, key, 0);
+}
+
+void editorRegexFindCallback(char *query, int key)
+{
+	editorFindStep(query, key, 1);
+}
+
+void editorFind(int regex)
+{
+	editorLoadAll(); /* Matches are looked for in the whole file */
+	int saved_cx = conf.cx, saved_cy = conf.cy;
+	int saved_coloff = conf.coloff, saved_rowoff = conf.rowoff;
+	char *query = regex ? editorPrompt("Regex search: %s (ESC = cancel | Arrows = next/previous | Enter = done)",
+	                                   editorRegexFindCallback)
+	                    : editorPrompt("Search: %s (ESC = cancel | Arrows = next/previous | Enter = done)",
+	                                   editorFindCallback);
+	if(query)
+	{
+		free(query);
+	}else
+	{
+		/* A canceled search puts the cursor back where it was */
+		conf.cx = saved_cx;
+		conf.cy = saved_cy;
+		conf.coloff = saved_coloff;
+		conf.rowoff = saved_rowoff;
+	}
+}
+
+/* Appending the text of a row between from and to to ab */
+void editorRowCopyTo(struct abuf *ab, editor_row *row, int from, int to)
+{
+	if(from >= to)
+	{
+		return;
+	}
+	if(from < row->gap)
+	{
+		abAppend(ab, row->chars + from, (to < row->gap ? to : row->gap) - from);
+	}
+	if(to > row->gap)
+	{
+		int start = from > row->gap ? from : row->gap;
+		abAppend(ab, row->chars + start + row->cap - row->size, to - start);
+	}
+}
+
+/* Replacing every match in the document in a single pass. A changed row gets all of its new text at once and is
+ * rendered again when it is drawn, and the document is marked dirty once for the whole range of changed rows.
+ * In with "&" stands for the matched text and "\&" for a "&". Returns the number of replaced matches. */
+long long editorReplaceAll(struct searchQuery *q, const char *with)
+{
+	struct abuf line = ABUF_INIT;
+	unsigned char *marks = NULL;
+	int markscap = 0;
+	long long count = 0;
+	int first = -1, last = -1;
+	int y = 0;
+	rowLeaf *leaf;
+	int j;
+	for(leaf = rowTreeFirst(); leaf; leaf = leaf->next)
+	{
+		for(j = 0; j < leaf->n; j++, y++)
+		{
+			editor_row view;
+			editor_row *row = rowLeafView(leaf, j, &view);
+			if(markscap < row->size + 1)
+			{
+				markscap = row->size + 1 > markscap * 2 ? row->size + 1 : markscap * 2;
+				marks = realloc(marks, markscap);
+			}
+			memset(marks, 0, row->size + 1);
+			int at, k;
+			if(q->re)
+			{
+				at = regexRowStarts(q->re, row, 0, -1, NULL, marks);
+			}else
+			{
+				at = editorRowFind(q, row, 0, 1);
+				for(k = at; k != -1; k = editorRowFind(q, row, k + 1, 1))
+				{
+					marks[k] = 1;
+				}
+			}
+			if(at == -1)
+			{
+				continue;
+			}
+			/* Only rows that change need rows of their own */
+			rowLeafExpand(leaf);
+			row = &leaf->rows[j];
+			/* Matches don't overlap, a match that starts inside the last replaced one is left alone */
+			line.len = 0;
+			int copied = 0;
+			for(; at <= row->size; at++)
+			{
+				if(!marks[at] || at < copied)
+				{
+					continue;
+				}
+				int len = q->re ? regexRowMatchLen(q->re, row, at) : q->len;
+				editorRowCopyTo(&line, row, copied, at);
+				int pos = line.len;
+				const char *w;
+				for(w = with; *w; w++)
+				{
+					if(*w == '\\' && (w[1] == '&' || w[1] == '\\'))
+					{
+						abAppend(&line, ++w, 1);
+					}else if(*w == '&')
+					{
+						editorRowCopyTo(&line, row, at, at + len);
+					}else
+					{
+						abAppend(&line, w, 1);
+					}
+				}
+				/* The record says where the match sits once the matches before it are replaced */
+				struct undoRecord *rec = editorUndoRecord(UNDO_SPLICE, y, pos, NULL, len, line.b + pos, line.len - pos);
+				editorJournalWrite(UNDO_SPLICE, y, pos, len, line.b + pos, line.len - pos);
+				if(rec)
+				{
+					int k;
+					for(k = 0; k < len; k++)
+					{
+						rec->text[k] = editorRowChar(row, at + k);
+					}
+				}
+				copied = at + len;
+				count++;
+			}
+			editorRowCopyTo(&line, row, copied, row->size);
+			editorRowSet(row, line.b, line.len);
+			if(first == -1)
+			{
+				first = y;
+			}
+			last = y;
+		}
+	}
+	abFree(&line);
+	free(marks);
+	if(count > 0)
+	{
+		editorMarkDirty(first, last + 1);
+		if(conf.cy < conf.numrows && conf.cx > editorRowAt(conf.cy)->size)
+		{
+			conf.cx = editorRowAt(conf.cy)->size;
+		}
+	}
+	return count;
+}
+
+void editorReplace()
+{
+	editorLoadAll();
+	char *pattern = editorPrompt("Replace regex: %s (ESC = cancel)", NULL);
+	if(pattern == NULL)
+	{
+		return;
+	}
+	struct searchQuery q;
+	if(pattern[0] == '\0' || searchCompileRegex(&q, pattern) == -1)
+	{
+		statusMessage("Not a valid pattern: %s", pattern);
+		free(pattern);
+		return;
+	}
+	char *with = editorPrompt("Replace with: %s (& = the match | ESC = cancel)", NULL);
+	if(with)
+	{
+		long long count = editorReplaceAll(&q, with);
+		statusMessage("Replaced %lld matches.", count);
+		free(with);
+	}
+	searchFree(&q);
+	free(pattern);
+}
+
+/* ====== SYNTAX HIGHLIGHTING ======*/
+char *C_HL_extensions[] = {".c", ".h", ".cpp", ".hpp", ".cc", NULL};
+char *C_HL_keywords[] = {
+	"switch", "if", "while", "for", "break", "continue", "return", "else",
+	"struct", "union", "typedef", "static", "enum", "class", "case", "default",
+	"do", "goto", "sizeof", "const", "volatile", "extern", "register", "inline",
+	"int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+	"void|", "short|", "size_t|", "bool|", NULL
+};
+
+/* Highlight database, the first entry matching the file name is used */
+struct editorSyntax HLDB[] = {
+	{
+		"c",
+		C_HL_extensions,
+		C_HL_keywords,
+		"//", "/*", "*/",
+		HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+	},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+/* A thread that lexes long runs of stale rows while the main thread waits for events. Like the workers it reads
+ * the rows under conf.rowlock, and the states it stores are seen by the main thread once it takes the lock back. */
+struct highlighter
+{
+	pthread_mutex_t lock; /* Protects everything in here */
+	pthread_cond_t cond;
+	int running;
+	int target; /* The rows before it are lexed next, 0 when there is nothing to do */
+};
+
+struct highlighter highlighter = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+
+int editorSyntaxIsSeparator(int c)
+{
+	return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}&|!?:^", c) != NULL;
+}
+
+/* Running the lexer over len bytes of s, starting in the given state, and returning the state they end in.
+ * Without hl only comments and strings are followed, they are all the state depends on. */
+int editorSyntaxLex(const char *s, int len, int state, unsigned char *hl)
+{
+	struct editorSyntax *syn = conf.syntax;
+	char *scs = syn->singleline_comment_start;
+	char *mcs = syn->multiline_comment_start;
+	char *mce = syn->multiline_comment_end;
+	int scslen = scs ? strlen(scs) : 0;
+	int mcslen = mcs ? strlen(mcs) : 0;
+	int mcelen = mce ? strlen(mce) : 0;
+	int prev_sep = 1;
+	int prev_hl = HL_NORMAL;
+	int in_string = 0;
+	int i = 0;
+	if(hl && len > 0)
+	{
+		memset(hl, HL_NORMAL, len);
+	}
+	while(i < len)
+	{
+		char c = s[i];
+		if(state == HL_STATE_COMMENT)
+		{
+			if(hl == NULL)
+			{
+				/* Only the end of the comment matters, memchr jumps to the places it can start at */
+				const char *p = mcelen ? memchr(&s[i], mce[0], len - i) : NULL;
+				if(p == NULL)
+				{
+					break;
+				}
+				i = p - s;
+			}
+			if(mcelen && i + mcelen <= len && memcmp(&s[i], mce, mcelen) == 0)
+			{
+				if(hl)
+				{
+					memset(&hl[i], HL_MLCOMMENT, mcelen);
+				}
+				i += mcelen;
+				state = HL_STATE_NORMAL;
+				prev_sep = 1;
+				continue;
+			}
+			if(hl)
+			{
+				hl[i] = HL_MLCOMMENT;
+			}
+			i++;
+			continue;
+		}
+		if(hl == NULL && !in_string)
+		{
+			/* Only characters that start a comment or a string change the state */
+			while(i < len && s[i] != '"' && s[i] != '\'' && (!scslen || s[i] != scs[0]) && (!mcslen || s[i] != mcs[0]))
+			{
+				i++;
+			}
+			if(i == len)
+			{
+				break;
+			}
+			c = s[i];
+		}
+		if(in_string)
+		{
+			int n = c == '\\' && i + 1 < len ? 2 : 1;
+			if(hl)
+			{
+				memset(&hl[i], HL_STRING, n);
+			}
+			if(c == in_string)
+			{
+				in_string = 0;
+			}
+			i += n;
+			prev_sep = 1;
+			continue;
+		}
+		if(scslen && i + scslen <= len && memcmp(&s[i], scs, scslen) == 0)
+		{
+			if(hl)
+			{
+				memset(&hl[i], HL_COMMENT, len - i);
+			}
+			break;
+		}
+		if(mcslen && i + mcslen <= len && memcmp(&s[i], mcs, mcslen) == 0)
+		{
+			if(hl)
+			{
+				memset(&hl[i], HL_MLCOMMENT, mcslen);
+			}
+			i += mcslen;
+			state = HL_STATE_COMMENT;
+			continue;
+		}
+		if((syn->flags & HL_HIGHLIGHT_STRINGS) && (c == '"' || c == '\''))
+		{
+			if(hl)
+			{
+				hl[i] = HL_STRING;
+			}
+			in_string = c;
+			i++;
+			continue;
+		}
+		if(hl == NULL)
+		{
+			i++;
+			continue;
+		}
+		if((syn->flags & HL_HIGHLIGHT_NUMBERS) &&
+		   ((isdigit((unsigned char)c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)))
+		{
+			hl[i++] = prev_hl = HL_NUMBER;
+			prev_sep = 0;
+			continue;
+		}
+		/* A whole word is looked at once, it can't hold the start of a string or a comment */
+		if(prev_sep && (isalpha((unsigned char)c) || c == '_'))
+		{
+			int end = i;
+			while(end < len && (isalnum((unsigned char)s[end]) || s[end] == '_'))
+			{
+				end++;
+			}
+			prev_hl = HL_NORMAL;
+			if(end == len || editorSyntaxIsSeparator(s[end]))
+			{
+				char **keywords = syn->keywords;
+				int j;
+				for(j = 0; keywords[j]; j++)
+				{
+					int klen = strlen(keywords[j]);
+					int kw2 = keywords[j][klen - 1] == '|';
+					if(kw2)
+					{
+						klen--;
+					}
+					if(klen == end - i && memcmp(&s[i], keywords[j], klen) == 0)
+					{
+						prev_hl = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+						memset(&hl[i], prev_hl, klen);
+						break;
+					}
+				}
+			}
+			i = end;
+			prev_sep = 0;
+			continue;
+		}
+		prev_hl = HL_NORMAL;
+		prev_sep = editorSyntaxIsSeparator(c);
+		i++;
+	}
+	return state;
+}
+
+/* Characters of a row in one piece. The main thread closes the gap, the highlighter thread copies rows that have
+ * one into scratch instead, since workers may read them at the same time. */
+const char *editorSyntaxRowText(editor_row *row, char **scratch, int *cap)
+{
+	if(scratch == NULL)
+	{
+		return editorRowFlatten(row);
+	}
+	if((row->flags & ROW_MAPPED) || row->gap == row->size)
+	{
+		return row->chars;
+	}
+	if(*cap < row->size)
+	{
+		*cap = row->size * 2;
+		*scratch = realloc(*scratch, *cap);
+	}
+	memcpy(*scratch, row->chars, row->gap);
+	memcpy(*scratch + row->gap, &row->chars[row->gap + row->cap - row->size], row->size - row->gap);
+	return *scratch;
+}
+
+/* Bringing the end states of the rows before row to up to date, lexing about budget bytes at most. Edits only widen
+ * the range of stale rows, they are lexed here from the first one on, and the pass stops at the first row past them
+ * that ends in the state it ended in before, nothing after it can change then. Returns 1 once the rows are done. */
+int editorSyntaxLexRows(int to, long budget, char **scratch, int *cap)
+{
+	/* Without an array for the states of the indexed rows there is nothing to keep them in, see editorSyntaxUpdate */
+	if(conf.syntax == NULL || (conf.index.n > 0 && conf.index.hl_state == NULL))
+	{
+		return 1;
+	}
+	if(to > conf.numrows)
+	{
+		to = conf.numrows;
+	}
+	int y = conf.hl_lo;
+	if(y >= to)
+	{
+		return 1;
+	}
+	/* The rows are walked leaf by leaf like the workers do, editorRowAt would change the row cache */
+	int base = 0;
+	rowLeaf *leaf = rowTreeDescend(y, &base, 0);
+	int j = y - base;
+	int state = HL_STATE_NORMAL;
+	if(j > 0)
+	{
+		state = rowLeafState(leaf, j - 1);
+	}else if(leaf->prev)
+	{
+		state = rowLeafState(leaf->prev, leaf->prev->n - 1);
+	}
+	editor_row view;
+	for(; y < to && budget > 0; y++, j++)
+	{
+		if(j == leaf->n)
+		{
+			leaf = leaf->next;
+			j = 0;
+		}
+		editor_row *row = rowLeafView(leaf, j, &view);
+		int end = editorSyntaxLex(editorSyntaxRowText(row, scratch, cap), row->size, state, NULL);
+		int same = end == row->hl_state;
+		budget -= row->size + 1;
+		rowLeafSetState(leaf, j, end);
+		state = end;
+		if(same && y + 1 >= conf.hl_hi)
+		{
+			conf.hl_lo = INT_MAX;
+			conf.hl_hi = 0;
+			return 1;
+		}
+	}
+	/* Row y was lexed from an older state, so the pass can't stop before it next time */
+	conf.hl_lo = y;
+	if(conf.hl_hi < y + 1)
+	{
+		conf.hl_hi = y + 1;
+	}
+	return y >= to;
+}
+
+void *editorHighlightRun(void *arg)
+{
+	char *scratch = NULL;
+	int cap = 0;
+	(void)arg;
+	pthread_mutex_lock(&highlighter.lock);
+	while(1)
+	{
+		int target = highlighter.target;
+		if(target == 0)
+		{
+			pthread_cond_wait(&highlighter.cond, &highlighter.lock);
+			continue;
+		}
+		pthread_mutex_unlock(&highlighter.lock);
+
+		/* The lock is let go after every chunk, so a key never waits for more than one */
+		pthread_rwlock_rdlock(&conf.rowlock);
+		int done = editorSyntaxLexRows(target, SIMPLR_HL_CHUNK, &scratch, &cap);
+		pthread_rwlock_unlock(&conf.rowlock);
+
+		pthread_mutex_lock(&highlighter.lock);
+		if(done && highlighter.target == target)
+		{
+			highlighter.target = 0;
+			editorWake(); /* The rows on screen can be drawn in colour now */
+		}
+	}
+	return NULL;
+}
+
+/* Pointing the highlighter thread at the rows before to, the rows it was lexing before don't matter any more */
+void editorHighlightStart(int to)
+{
+	pthread_mutex_lock(&highlighter.lock);
+	if(!highlighter.running)
+	{
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, editorHighlightRun, NULL) == 0)
+		{
+			pthread_detach(thread);
+			highlighter.running = 1;
+		}
+	}
+	highlighter.target = to > 0 ? to : 1;
+	pthread_cond_signal(&highlighter.cond);
+	pthread_mutex_unlock(&highlighter.lock);
+}
+
+/* Getting the states of the rows before to ready for drawing. Few stale rows, like the ones a key leaves, are lexed
+ * right away, more than that are left to the highlighter thread and drawn without colours until it is done. */
+void editorSyntaxUpdate(int to)
+{
+	/* Rows only in the row index keep their states in it, the array is made before any thread lexes them */
+	if(conf.syntax && conf.index.n > 0 && conf.index.hl_state == NULL)
+	{
+		conf.index.hl_cap = conf.index.n;
+		conf.index.hl_state = malloc(conf.index.hl_cap);
+		memset(conf.index.hl_state, HL_STATE_UNKNOWN, conf.index.hl_cap);
+	}
+	if(!editorSyntaxLexRows(to, SIMPLR_HL_BUDGET, NULL, NULL))
+	{
+		editorHighlightStart(to);
+	}
+}
+
+/* Making sure the highlight of a row that is drawn matches its render and the state the row before it ends in */
+void editorRowPrepareHighlight(int filerow, editor_row *row)
+{
+	int open = filerow > 0 ? editorRowAt(filerow - 1)->hl_state : HL_STATE_NORMAL;
+	if((row->flags & ROW_HL_VALID) && row->hl_open == open)
+	{
+		return;
+	}
+	if(row->hl == NULL)
+	{
+		row->hl = rowStoreAlloc(&conf.store, row->rsize + 1, NULL);
+	}
+	editorSyntaxLex(row->render, row->rsize, open, row->hl);
+	row->hl_open = open;
+	row->flags |= ROW_HL_VALID;
+}
+
+int editorSyntaxToColor(int hl)
+{
+	switch(hl)
+	{
+		case HL_COMMENT:
+		case HL_MLCOMMENT: return 36;
+		case HL_KEYWORD1: return 33;
+		case HL_KEYWORD2: return 32;
+		case HL_STRING: return 35;
+		case HL_NUMBER: return 31;
+		default: return 39;
+	}
+}
+
+/* Appending len columns of a highlighted row, a colour escape is only written where the colour changes */
+void editorSyntaxAppend(struct abuf *ab, const char *s, const unsigned char *hl, int len)
+{
+	int color = 39;
+	int i = 0;
+	while(i < len)
+	{
+		int next = editorSyntaxToColor(hl[i]);
+		int j = i + 1;
+		while(j < len && editorSyntaxToColor(hl[j]) == next)
+		{
+			j++;
+		}
+		if(next != color)
+		{
+			char buf[16];
+			int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", next);
+			abAppend(ab, buf, clen);
+			color = next;
+		}
+		abAppend(ab, &s[i], j - i);
+		i = j;
+	}
+	if(color != 39)
+	{
+		abAppend(ab, "\x1b[39m", 5);
+	}
+}
+
+/* Picking the syntax by the name of the file, every row is lexed again the next time it is drawn */
+void editorSelectSyntax()
+{
+	conf.syntax = NULL;
+	editorRenderEvictRange(conf.render_lo, conf.render_hi);
+	conf.render_lo = conf.render_hi = 0;
+	conf.hl_lo = 0;
+	conf.hl_hi = conf.numrows;
+	if(conf.filename == NULL)
+	{
+		return;
+	}
+	int len = strlen(conf.filename);
+	unsigned int j;
+	for(j = 0; j < HLDB_ENTRIES; j++)
+	{
+		struct editorSyntax *syn = &HLDB[j];
+		int i;
+		for(i = 0; syn->filematch[i]; i++)
+		{
+			int mlen = strlen(syn->filematch[i]);
+			if(len >= mlen && strcmp(&conf.filename[len - mlen], syn->filematch[i]) == 0)
+			{
+				conf.syntax = syn;
+				return;
+			}
+		}
+	}
+}
+
+/* ====== OUTPUT ======*/
+void editorScroll()
+{
+	conf.rx = 0;
+	if(conf.cy < conf.numrows)
+	{
+		conf.rx = editorRowCxToRx(editorRowAt(conf.cy), conf.cx);
+	}
+	
+	/* Checking if the user cursor is above the visible window, and if it is it scrolls up to that position*/
+	if(conf.cy < conf.rowoff)
+	{
+		conf.rowoff = conf.cy;
+	}
+
+	/* Checking if the user cursor is below visible window*/
+	if(conf.cy >= conf.rowoff + conf.screenrows)
+	{
+		conf.rowoff = conf.cy - conf.screenrows + 1;
+	}
+	if(conf.rx < conf.coloff)
+	{
+		conf.coloff = conf.rx; 
+	}
+	if(conf.rx >= conf.coloff + conf.screencols)
+	{
+		conf.coloff = conf.rx - conf.screencols + 1;
+	}
+}
+
+/* ====== SCREEN FRAME ======*/
+/* Forgetting what is on the screen, so the next refresh clears it and draws every line */
+void editorFrameInvalidate()
+{
+	conf.frame_rows = 0;
+}
+
+/* Starting from a cleared screen whenever the frame doesn't match the window */
+void editorFrameReset(struct abuf *ab)
+{
+	int rows = conf.screenrows + 2;
+	int y;
+	if(conf.frame_rows == rows)
+	{
+		return;
+	}
+	for(y = 0; y < conf.frame_rows; y++)
+	{
+		abFree(&conf.frame[y]);
+	}
+	free(conf.frame);
+	conf.frame = malloc(sizeof(struct abuf) * rows);
+	for(y = 0; y < rows; y++)
+	{
+		struct abuf empty = ABUF_INIT;
+		conf.frame[y] = empty;
+	}
+	conf.frame_rows = rows;
+	conf.frame_rowoff = conf.rowoff;
+	conf.frame_coloff = conf.coloff;
+	abAppend(ab, "\x1b[2J", 4);
+}
+
+/* When the view moved by a few rows, the terminal scrolls the text area itself and only the uncovered lines are drawn */
+void editorFrameScroll(struct abuf *ab)
+{
+	int d = conf.rowoff - conf.frame_rowoff;
+	int rows = conf.screenrows;
+	int y;
+	if(d == 0 || conf.coloff != conf.frame_coloff || d >= rows / 2 || -d >= rows / 2)
+	{
+		conf.frame_rowoff = conf.rowoff;
+		conf.frame_coloff = conf.coloff;
+		return;
+	}
+	char buf[32];
+	int n = d > 0 ? d : -d;
+	/* Scrolling inside a region that leaves the status and message bars alone */
+	int len = snprintf(buf, sizeof(buf), "\x1b[1;%dr\x1b[%d%c\x1b[r", rows, n, d > 0 ? 'S' : 'T');
+	abAppend(ab, buf, len);
+
+	struct abuf *lines = conf.frame;
+	struct abuf *moved = malloc(sizeof(struct abuf) * n);
+	if(d > 0)
+	{
+		memcpy(moved, lines, sizeof(struct abuf) * n);
+		memmove(lines, &lines[n], sizeof(struct abuf) * (rows - n));
+		memcpy(&lines[rows - n], moved, sizeof(struct abuf) * n);
+		for(y = rows - n; y < rows; y++)
+		{
+			lines[y].len = 0;
+		}
+	}else
+	{
+		memcpy(moved, &lines[rows - n], sizeof(struct abuf) * n);
+		memmove(&lines[n], lines, sizeof(struct abuf) * (rows - n));
+		memcpy(lines, moved, sizeof(struct abuf) * n);
+		for(y = 0; y < n; y++)
+		{
+			lines[y].len = 0;
+		}
+	}
+	free(moved);
+	conf.frame_rowoff = conf.rowoff;
+}
+
+/* Writing a screen line only if it differs from what the terminal already shows there */
+void editorFrameLine(struct abuf *ab, int y, struct abuf *line)
+{
+	struct abuf *old = &conf.frame[y];
+	if(old->len == line->len && (line->len == 0 || memcmp(old->b, line->b, line->len) == 0))
+	{
+		line->len = 0;
+		return;
+	}
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "\x1b[%d;1H", y + 1);
+	abAppend(ab, buf, len);
+	abAppend(ab, line->b, line->len);
+	abAppend(ab, "\x1b[K", 3);
+	/* The new line becomes the frame line, and the old buffer is reused for the next line */
+	struct abuf tmp = *old;
+	*old = *line;
+	*line = tmp;
+	line->len = 0;
+}
+
+/*Function for drawing ~ on every row(just like vim heh)*/
+void editorRowDraw(struct abuf *ab)
+{
+	int y; 
+	struct abuf line = ABUF_INIT;
+	long long start = perfNowNs();
+	editorRenderTrack(conf.rowoff, conf.rowoff + conf.screenrows);
+	editorSyntaxUpdate(conf.rowoff + conf.screenrows);
+	for(y = 0; y < conf.screenrows; y++)
+	{
+		int filerow = y + conf.rowoff;
+		if(filerow >= conf.numrows){
+			if(y >= conf.numrows)
+			{
+				/* Displaying our welcome message only if the text buffer is empty*/
+				/* We don't want to display welcome message if the user opened his file*/
+				if(conf.numrows == 0 && y == conf.screenrows / 3)
+				{
+					char welcome_message[80];
+					int messagelen = snprintf(welcome_message, sizeof(welcome_message),
+					  "Simplr editor - %s", SIMPLR_VERSION);
+					if(messagelen > conf.screencols)
+					{
+						messagelen = conf.screencols;
+					}
+					int padding = (conf.screencols - messagelen) / 2;
+					if(padding)
+					{
+						abAppend(&line, "-", 1);
+						padding--;
+					}
+					while(padding--)
+					{
+						abAppend(&line, " ", 1);
+					}
+					abAppend(&line, welcome_message, messagelen);
+	
+				}else
+				{
+					abAppend(&line, "-", 1);
+				}
+			}
+			}else
+			{
+				editor_row *row = editorRowAt(filerow);
+				editorRowPrepareRender(row);
+				int len = row->rsize - conf.coloff; 
+				if(len < 0)
+				{
+					len = 0; 
+				}
+				if(len > conf.screencols)
+				{
+					len = conf.screencols;
+				}
+				/* Rows past the first stale one don't know the state they start in yet and stay plain */
+				if(conf.syntax && filerow <= conf.hl_lo)
+				{
+					editorRowPrepareHighlight(filerow, row);
+					editorSyntaxAppend(&line, &row->render[conf.coloff], &row->hl[conf.coloff], len);
+				}else
+				{
+					abAppend(&line, &row->render[conf.coloff], len);
+				}
+		}
+		editorFrameLine(ab, y, &line);
+	}
+	abFree(&line);
+	perfRecord(PERF_ROWS, start);
+}
+
+/* Function for drawing the status bar on bottom of the screen*/
+void statusBar(struct abuf *ab)
+{
+	struct abuf line = ABUF_INIT;
+	abAppend(&line, "\x1b[7m", 4);
+	char status[96], rstatus[80];
+	int len = 0;
+	if(conf.nbuffers > 1)
+	{
+		len = snprintf(status, sizeof(status), "[%d/%d] ", conf.buffer + 1, conf.nbuffers);
+	}
+	len += snprintf(status + len, sizeof(status) - len, "%.20s - %d lines %s",
+			conf.filename ? conf.filename : "[No Name]", conf.numrows,
+			conf.dirty_flag ? "(file is changed)" : "");
+	if(conf.load)
+	{
+		len += snprintf(status + len, sizeof(status) - len, "%s(loading %d%%)", conf.dirty_flag ? " " : "",
+				(int)(conf.load->loaded * 100 / conf.load->size));
+	}
+	/* A search shows which match the cursor is on instead of the line number */
+	int rlen = editorSearchStatus(rstatus, sizeof(rstatus));
+	if(rlen == 0)
+	{
+		rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
+				conf.cy + 1, conf.numrows);
+	}
+	if(len > conf.screencols)
+	{
+		len = conf.screencols;     
+	}	
+	abAppend(&line, status, len);
+	while(len  < conf.screencols)
+	{
+		if(conf.screencols - len == rlen)
+		{
+			abAppend(&line, rstatus, rlen);
+			break;
+		}else
+		{
+			abAppend(&line, " ", 1);
+			len++;
+		}
+	}
+	abAppend(&line, "\x1b[m", 3);
+	editorFrameLine(ab, conf.screenrows, &line);
+	abFree(&line);
+}
+
+void messageBar(struct abuf *ab)
+{
+	struct abuf line = ABUF_INIT;
+	int msglen = strlen(conf.status_message);
+	if(msglen > conf.screencols)
+	{
+		msglen = conf.screencols;
+	}
+	if(conf.perf_overlay)
+	{
+		/* The counters of the frame before, this one isn't done yet */
+		char overlay[160];
+		int len = snprintf(overlay, sizeof(overlay), "frame %.2f ms | %lld bytes written | %lld rows rendered | key %.2f ms | heap %.1f MB",
+				perf.last_frame_ns / 1e6, perf.last_frame_bytes, perf.last_frame_rows, perf.last_key_ns / 1e6,
+				perfHeapBytes() / 1048576.0);
+		abAppend(&line, overlay, len < conf.screencols ? len : conf.screencols);
+	}else if(msglen && time(NULL) - conf.status_message_time < SIMPLR_MESSAGE_TIME)
+	{
+		abAppend(&line, conf.status_message, msglen);
+	}
+	editorFrameLine(ab, conf.screenrows + 1, &line);
+	abFree(&line);
+}
+
+/* Milliseconds until the screen changes by itself, -1 if it never does */
+int editorNextTimeout()
+{
+	int journal = editorJournalTimeout();
+	if(conf.follow.active && conf.follow.more)
+	{
+		return 0; /* The rest of an append is read after the screen showed the part before it */
+	}
+	/* The status message disappears after SIMPLR_MESSAGE_TIME seconds */
+	if(conf.status_message[0] == '\0' || conf.frame_rows == 0 || conf.frame[conf.screenrows + 1].len == 0)
+	{
+		return journal;
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	long long ms = ((long long)conf.status_message_time + SIMPLR_MESSAGE_TIME - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+	if(ms < 0)
+	{
+		ms = 0;
+	}
+	return journal != -1 && journal < ms ? journal : (int)ms;
+}
+
+/*Function for clearing user's screen*/
+void clearScreen() 
+{
+	long long start = perfNowNs();
+	long long frame = start;
+	long long rows = perf.rows_rendered;
+	editorScroll();
+	start = perfRecord(PERF_SCROLL, start);
+	struct abuf ab = ABUF_INIT;
+	
+	abAppend(&ab, "\x1b[?25l", 6);
+	editorFrameReset(&ab);
+	editorFrameScroll(&ab);
+
+	editorRowDraw(&ab);
+	statusBar(&ab);
+	messageBar(&ab);
+	
+	char buf[32];
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (conf.cy - conf.rowoff) + 1, conf.cx + 1);
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", conf.cy + 1, conf.cx + 1);
+	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (conf.cy - conf.rowoff) + 1,
+                                            (conf.rx - conf.coloff) + 1);
+	abAppend(&ab, buf, strlen(buf));	
+	abAppend(&ab, "\x1b[?25h", 6);
+	start = perfRecord(PERF_RENDER, start);
+
+	write(STDOUT_FILENO, ab.b, ab.len);
+	start = perfRecord(PERF_WRITE, start);
+	perfRecord(PERF_FRAME, frame);
+	perf.frames++;
+	perf.bytes += ab.len;
+	perf.last_frame_ns = start - frame;
+	perf.last_frame_bytes = ab.len;
+	perf.last_frame_rows = perf.rows_rendered - rows;
+	abFree(&ab);
+}
+
+void statusMessage(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(conf.status_message, sizeof(conf.status_message), fmt, ap);
+	va_end(ap);
+	conf.status_message_time = time(NULL);
+	
+}
+/* ====== BUFFERS ======*/
+#define BUFFER_SWAP(field) do { __typeof__(conf.field) t = conf.field; conf.field = b->field; b->field = t; } while(0)
+
+/* Exchanging the document in conf with the one in b */
+void editorBufferSwap(struct editorBuffer *b)
+{
+	BUFFER_SWAP(cx);
+	BUFFER_SWAP(cy);
+	BUFFER_SWAP(coloff);
+	BUFFER_SWAP(rx);
+	BUFFER_SWAP(rowoff);
+	BUFFER_SWAP(numrows);
+	BUFFER_SWAP(rows);
+	BUFFER_SWAP(index);
+	BUFFER_SWAP(file);
+	BUFFER_SWAP(rowcache);
+	BUFFER_SWAP(rowcache_base);
+	BUFFER_SWAP(render_lo);
+	BUFFER_SWAP(render_hi);
+	BUFFER_SWAP(syntax);
+	BUFFER_SWAP(hl_lo);
+	BUFFER_SWAP(hl_hi);
+	BUFFER_SWAP(dirty_flag);
+	BUFFER_SWAP(dirty_lo);
+	BUFFER_SWAP(dirty_hi);
+	BUFFER_SWAP(filename);
+	BUFFER_SWAP(map);
+	BUFFER_SWAP(mapsize);
+	BUFFER_SWAP(map_dev);
+	BUFFER_SWAP(map_ino);
+	BUFFER_SWAP(filestat);
+	BUFFER_SWAP(filestat_valid);
+	BUFFER_SWAP(save);
+	BUFFER_SWAP(undo);
+	BUFFER_SWAP(journal);
+	BUFFER_SWAP(store);
+	BUFFER_SWAP(follow);
+	BUFFER_SWAP(load);
+}
+
+/* Setting up an empty document in conf */
+void editorBufferInit()
+{
+	conf.cx = 0;
+	conf.cy = 0;
+	conf.rx = 0;
+	conf.numrows = 0;
+	conf.rows = NULL;
+	memset(&conf.index, 0, sizeof(conf.index));
+	conf.file = NULL;
+	conf.rowcache = NULL;
+	conf.render_lo = conf.render_hi = 0;
+	conf.syntax = NULL;
+	conf.hl_lo = INT_MAX;
+	conf.hl_hi = 0;
+	editorMarkClean();
+	conf.rowoff = 0; /* We initialize it as 0 which means user will be scrolled to the top of the file by default*/
+	conf.coloff = 0;
+	conf.filename = NULL;
+	conf.map = NULL;
+	conf.mapsize = 0;
+	conf.filestat_valid = 0;
+	conf.save = NULL;
+	memset(&conf.undo, 0, sizeof(conf.undo));
+	memset(&conf.journal, 0, sizeof(conf.journal));
+	conf.journal.fd = -1;
+	memset(&conf.store, 0, sizeof(conf.store));
+	memset(&conf.follow, 0, sizeof(conf.follow));
+	conf.load = NULL;
+}
+
+/* Putting the shown buffer away, the workers count matches in the rows of the shown buffer only */
+void editorBufferLeave()
+{
+	editorSearchCountStop();
+	if(conf.journal.len > 0 || conf.journal.resync)
+	{
+		editorJournalFlush(1); /* Edits of a buffer that isn't shown aren't held back until it is shown again */
+	}
+	editorBufferSwap(&conf.buffers[conf.buffer]);
+}
+
+void editorBufferSwitch(int k)
+{
+	if(k == conf.buffer)
+	{
+		return;
+	}
+	editorBufferLeave();
+	conf.buffer = k;
+	editorBufferSwap(&conf.buffers[k]);
+	editorLoadPoll(); /* Rows the loader thread indexed while the buffer wasn't shown */
+	if(conf.follow.active)
+	{
+		conf.follow.more = 1; /* The file may have grown while the buffer wasn't shown */
+	}
+}
+
+/* Adding an empty buffer after the others and showing it */
+void editorBufferNew()
+{
+	editorBufferLeave();
+	conf.buffers = realloc(conf.buffers, sizeof(struct editorBuffer) * (conf.nbuffers + 1));
+	memset(&conf.buffers[conf.nbuffers], 0, sizeof(struct editorBuffer));
+	conf.buffer = conf.nbuffers++;
+	editorBufferInit();
+}
+
+/* Freeing the document of the shown buffer, its rows come from its row store and go away all at once */
+void editorBufferFree()
+{
+	editorLoadStop();
+	editorFollowStop();
+	rowLeaf *leaf = rowTreeFirst();
+	while(leaf)
+	{
+		rowLeaf *next = leaf->next;
+		rowTreeFreeLeaf(leaf);
+		leaf = next;
+	}
+	rowStoreRelease(&conf.store);
+	editorUndoReset();
+	free(conf.index.hl_state);
+	if(conf.file)
+	{
+		editorFileRelease(conf.file);
+	}
+	free(conf.filename);
+	free(conf.journal.path);
+	free(conf.journal.buf);
+	free(conf.journal.carry);
+}
+
+/* Closing the shown buffer and showing the one after it, closing the last one leaves an empty buffer */
+void editorBufferClose()
+{
+	editorSearchCountStop();
+	editorSaveWait(1);
+	editorJournalDiscard(); /* The unsaved edits are dropped, like when quitting */
+	editorBufferFree();
+	conf.nbuffers--;
+	memmove(&conf.buffers[conf.buffer], &conf.buffers[conf.buffer + 1],
+			sizeof(struct editorBuffer) * (conf.nbuffers - conf.buffer));
+	if(conf.nbuffers == 0)
+	{
+		conf.nbuffers = 1;
+		editorBufferInit();
+		return;
+	}
+	if(conf.buffer == conf.nbuffers)
+	{
+		conf.buffer--;
+	}
+	editorBufferSwap(&conf.buffers[conf.buffer]);
+}
+
+/* Opening a file in a buffer of its own */
+void editorBufferOpen()
+{
+	char *name = editorPrompt("Open: %s (ESC = cancel)", NULL);
+	if(name == NULL)
+	{
+		return;
+	}
+	/* A file that can't be read leaves the buffers as they are */
+	int fd = open(name, O_RDONLY);
+	if(fd == -1)
+	{
+		statusMessage("Can't open %s: %s", name, strerror(errno));
+		free(name);
+		return;
+	}
+	close(fd);
+	editorBufferNew();
+	editorOpen(name);
+	free(name);
+}
+
+/* Finishing the saves that run in any buffer, the shown buffer stays the same */
+void editorBufferSaveWait()
+{
+	int shown = conf.buffer;
+	int k;
+	editorSaveWait(1);
+	for(k = 0; k < conf.nbuffers; k++)
+	{
+		if(k != shown && conf.buffers[k].save)
+		{
+			editorBufferSwitch(k);
+			editorSaveWait(1);
+		}
+	}
+	editorBufferSwitch(shown);
+}
+
+/* Stopping the loads of every buffer, the loader threads of buffers that aren't shown run as well */
+void editorBufferLoadStop()
+{
+	int shown = conf.buffer;
+	int k;
+	editorLoadStop();
+	for(k = 0; k < conf.nbuffers; k++)
+	{
+		if(k != shown && conf.buffers[k].load)
+		{
+			editorBufferSwitch(k);
+			editorLoadStop();
+		}
+	}
+	editorBufferSwitch(shown);
+}
+
+/* Number of buffers that aren't shown and have unsaved changes */
+int editorBufferOthersDirty()
+{
+	int n = 0;
+	int k;
+	for(k = 0; k < conf.nbuffers; k++)
+	{
+		if(k != conf.buffer && conf.buffers[k].dirty_flag)
+		{
+			n++;
+		}
+	}
+	return n;
+}
+
+/* Throwing away the journals of every buffer when quitting */
+void editorBufferDiscardJournals()
+{
+	int k;
+	for(k = 0; k < conf.nbuffers; k++)
+	{
+		editorBufferSwitch(k);
+		editorJournalDiscard();
+	}
+}
+
+/* ====== FOLLOW ======*/
+/* Following a file that is still written, like a log. inotify tells when the file changes, then only the bytes after
+ * the ones already read are read and become rows after the last one, the rows before them aren't looked at again. */
+
+/* Adding the len characters at s as a row after the last one, newline tells if a newline ended them in the file.
+ * Appended text isn't an edit, so it isn't recorded for undo or in the journal. */
+void editorFollowAddRow(const char *s, int len, int newline)
+{
+	int y = conf.numrows;
+	if(!newline || (len > 0 && s[len - 1] == '\r'))
+	{
+		editorMarkConverted(y);
+	}
+	if(newline && len > 0 && s[len - 1] == '\r')
+	{
+		len--;
+	}
+	int cap;
+	char *chars = rowStoreAlloc(&conf.store, len + 1, &cap);
+	memcpy(chars, s, len);
+	editorRowInitOwned(rowTreeInsert(y), chars, len, cap);
+}
+
+/* Adding the len characters at s to the last row, which the file didn't end with a newline yet */
+void editorFollowExtend(const char *s, int len, int newline)
+{
+	int y = conf.numrows - 1;
+	conf.journal.paused++;
+	editorRowSplice(y, editorRowAt(y)->size, 0, s, len);
+	conf.journal.paused--;
+	editor_row *row = editorRowAt(y);
+	if(newline && row->size > 0 && row->chars[row->size - 1] == '\r')
+	{
+		/* The gap is at the end after the splice, so the \r is the last character before it */
+		row->size--;
+		row->gap--;
+	}
+	editorMarkConverted(y);
+}
+
+void editorFollowStop()
+{
+	if(!conf.follow.active)
+	{
+		return;
+	}
+	inotify_rm_watch(conf.inotify, conf.follow.wd);
+	close(conf.follow.fd);
+	conf.follow.active = 0;
+}
+
+void editorFollowStart()
+{
+	if(conf.filename == NULL || !conf.filestat_valid)
+	{
+		statusMessage("Only a file that was opened can be followed");
+		return;
+	}
+	if(conf.save)
+	{
+		statusMessage("The last save is still running.");
+		return;
+	}
+	editorLoadAll(); /* Appends are read from the end of the file */
+	if(conf.inotify == -1)
+	{
+		conf.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+	struct stat st;
+	int fd = conf.inotify == -1 ? -1 : open(conf.filename, O_RDONLY | O_CLOEXEC);
+	if(fd == -1 || fstat(fd, &st) == -1)
+	{
+		statusMessage("Can't follow %s: %s", conf.filename, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		return;
+	}
+	/* Appends are read from where the loaded text ended, which only makes sense for the file that was loaded */
+	if(st.st_dev != conf.filestat.st_dev || st.st_ino != conf.filestat.st_ino || st.st_size < conf.filestat.st_size)
+	{
+		statusMessage("%s was replaced since it was opened, open it again to follow it", conf.filename);
+		close(fd);
+		return;
+	}
+	int wd = inotify_add_watch(conf.inotify, conf.filename, IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF);
+	if(wd == -1)
+	{
+		statusMessage("Can't follow %s: %s", conf.filename, strerror(errno));
+		close(fd);
+		return;
+	}
+	struct editorFollow *f = &conf.follow;
+	f->active = 1;
+	f->fd = fd;
+	f->wd = wd;
+	f->offset = conf.filestat.st_size;
+	char last;
+	f->partial = f->offset > 0 && pread(fd, &last, 1, f->offset - 1) == 1 && last != '\n';
+	f->more = 1; /* The file may have grown since it was loaded */
+	f->gone = 0;
+	f->hash = JOURNAL_HASH_INIT;
+	f->hashed = 0;
+	editorJournalFollowed();
+	conf.cy = conf.numrows > 0 ? conf.numrows - 1 : 0;
+	conf.cx = 0;
+	statusMessage("Following %s, CTRL + T stops", conf.filename);
+}
+
+/* Hash of the bytes of the followed file that are rows, read from the file the first time a journal needs it */
+unsigned int editorFollowHash()
+{
+	struct editorFollow *f = &conf.follow;
+	char buf[65536];
+	while(f->hashed < f->offset)
+	{
+		long long want = f->offset - f->hashed < (long long)sizeof(buf) ? f->offset - f->hashed : (long long)sizeof(buf);
+		ssize_t n = pread(f->fd, buf, want, f->hashed);
+		if(n <= 0)
+		{
+			break; /* The hash stays short, so the journal isn't taken for the grown file */
+		}
+		f->hash = editorJournalHashMore(f->hash, buf, n);
+		f->hashed += n;
+	}
+	return f->hash;
+}
+
+/* Reading the next SIMPLR_FOLLOW_CHUNK bytes appended to the followed file. The cursor stays at the end if it was
+ * there, so the screen shows the newest rows. */
+void editorFollowRead()
+{
+	struct editorFollow *f = &conf.follow;
+	static char *buf = NULL; /* Kept, a log written quickly is read a chunk at a time for as long as it runs */
+	if(buf == NULL)
+	{
+		buf = malloc(SIMPLR_FOLLOW_CHUNK);
+	}
+	ssize_t n = pread(f->fd, buf, SIMPLR_FOLLOW_CHUNK, f->offset);
+	f->more = n == SIMPLR_FOLLOW_CHUNK;
+	if(n <= 0)
+	{
+		struct stat st;
+		if(n == -1)
+		{
+			statusMessage("Stopped following %s: %s", conf.filename, strerror(errno));
+			editorFollowStop();
+		}
+		else if(f->gone)
+		{
+			statusMessage("Stopped following %s, it was moved or deleted", conf.filename);
+			editorFollowStop();
+		}
+		else if(fstat(f->fd, &st) == 0 && st.st_size < f->offset)
+		{
+			statusMessage("Stopped following %s, it was truncated", conf.filename);
+			editorFollowStop();
+		}
+		return;
+	}
+	int oldrows = conf.numrows;
+	int end = conf.cy >= oldrows - 1;
+	int first = f->partial ? oldrows - 1 : oldrows;
+	char *p = buf;
+	char *stop = buf + n;
+	if(f->partial)
+	{
+		char *nl = memchr(p, '\n', n);
+		char *lineend = nl ? nl : stop;
+		editorFollowExtend(p, lineend - p, nl != NULL);
+		f->partial = nl == NULL;
+		p = nl ? nl + 1 : stop;
+	}
+	size_t ends[ROW_LEAF_MAX];
+	while(p < stop)
+	{
+		char *start = p;
+		int found = scanNewlines(start, stop - start, ends, ROW_LEAF_MAX);
+		int j;
+		for(j = 0; j < found; j++)
+		{
+			editorFollowAddRow(p, start + ends[j] - p, 1);
+			p = start + ends[j] + 1;
+		}
+		if(found < ROW_LEAF_MAX && p < stop)
+		{
+			editorFollowAddRow(p, stop - p, 0);
+			f->partial = 1;
+			p = stop;
+		}
+	}
+	if(f->hashed == f->offset)
+	{
+		f->hash = editorJournalHashMore(f->hash, buf, n);
+		f->hashed += n;
+	}
+	f->offset += n;
+	/* The file as read so far is the one the next save and the journal start from */
+	struct stat st;
+	if(fstat(f->fd, &st) == 0)
 	{
-		conf.rowoff = conf.cy;
+		conf.filestat.st_mtim = st.st_mtim;
 	}
-
-	/* Checking if the user cursor is below visible window*/
-	if(conf.cy >= conf.rowoff + conf.screenrows)
+	conf.filestat.st_size = f->offset;
+	editorJournalFollowed();
+	/* Only the new rows are lexed, the ones before keep their state */
+	if(first < conf.hl_lo)
 	{
-		conf.rowoff = conf.cy - conf.screenrows + 1;
+		conf.hl_lo = first;
 	}
-	if(conf.rx < conf.coloff)
+	if(conf.numrows > conf.hl_hi)
 	{
-		conf.coloff = conf.rx; 
+		conf.hl_hi = conf.numrows;
 	}
-	if(conf.rx >= conf.coloff + conf.screencols)
+	if(end && conf.numrows > oldrows)
 	{
-		conf.coloff = conf.rx - conf.screencols + 1;
+		conf.cy = conf.cy >= oldrows ? conf.numrows : conf.numrows - 1;
+		conf.cx = 0;
 	}
 }
 
-/*Function for drawing ~ on every row(just like vim heh)*/
-void editorRowDraw(struct abuf *ab)
+/* Reading the pending inotify events, a change of a followed file makes its buffer read again */
+void editorFollowEvents()
 {
-	int y; 
-	for(y = 0; y < conf.screenrows; y++)
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+	while((n = read(conf.inotify, buf, sizeof(buf))) > 0)
 	{
-		int filerow = y + conf.rowoff;
-		if(filerow >= conf.numrows){
-			if(y >= conf.numrows)
+		char *p = buf;
+		while(p < buf + n)
+		{
+			struct inotify_event *e = (struct inotify_event *)p;
+			int k;
+			for(k = -1; k < conf.nbuffers; k++)
 			{
-				/* Displaying our welcome message only if the text buffer is empty*/
-				/* We don't want to display welcome message if the user opened his file*/
-				if(conf.numrows == 0 && y == conf.screenrows / 3)
+				/* The buffers that aren't shown catch up when they are shown again, only their removal is kept */
+				struct editorFollow *f = k == -1 ? &conf.follow : k != conf.buffer ? &conf.buffers[k].follow : NULL;
+				if(f && f->active && f->wd == e->wd)
 				{
-					char welcome_message[80];
-					int messagelen = snprintf(welcome_message, sizeof(welcome_message),
-					  "Simplr editor - %s", SIMPLR_VERSION);
-					if(messagelen > conf.screencols)
-					{
-						messagelen = conf.screencols;
-					}
-					int padding = (conf.screencols - messagelen) / 2;
-					if(padding)
-					{
-						abAppend(ab, "-", 1);
-						padding--;
-					}
-					while(padding--)
+					f->more = 1;
+					if(e->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
 					{
-						abAppend(ab, " ", 1);
+						f->gone = 1;
 					}
-					abAppend(ab, welcome_message, messagelen);
-	
-				}else
-				{
-					abAppend(ab, "-", 1);
 				}
 			}
-			}else
-			{
-				int len = conf.row[filerow].rsize - conf.coloff; 
-				if(len < 0)
-				{
-					len = 0; 
-				}
-				if(len > conf.screencols)
-				{
-					len = conf.screencols;
-				}
-				abAppend(ab, &conf.row[filerow].render[conf.coloff], len);
+			p += sizeof(struct inotify_event) + e->len;
 		}
-		abAppend(ab, "\x1b[K", 3);
-		abAppend(ab, "\r\n", 2);
 	}
 }
 
-/* Function for drawing the status bar on bottom of the screen*/
-void statusBar(struct abuf *ab)
+/* ====== INPUT ====== */
+/* Reading a bracketed paste up to its end marker and inserting it as one block. A paste whose end marker got lost
+ * ends once no byte arrives for SIMPLR_PASTE_TIMEOUT milliseconds, or when a benchmark runs out of keys. */
+void editorPaste()
 {
-	abAppend(ab, "\x1b[7m", 4);
-	char status[80], rstatus[80];
-	int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-			conf.filename ? conf.filename : "[No Name]", conf.numrows,
-			conf.dirty_flag ? "(file is changed)" : "");
-	int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d",
-			conf.cy + 1, conf.numrows);
-	if(len > conf.screencols)
-	{
-		len = conf.screencols;     
-	}	
-	abAppend(ab, status, len);
-	while(len  < conf.screencols)
+	static const char endmark[] = "\x1b[201~";
+	struct abuf text = ABUF_INIT;
+	long long deadline = 0; /* Set when the input runs dry, cleared by the next byte */
+	char c;
+	while(1)
 	{
-		if(conf.screencols - len == rlen)
+		if(!editorInputByte(&c, 0))
 		{
-			abAppend(ab, rstatus, rlen);
-			break;
-		}else
+			if(deadline == 0)
+			{
+				deadline = editorNowMs() + SIMPLR_PASTE_TIMEOUT;
+			}
+			long long left = deadline - editorNowMs();
+			if(conf.bench || left <= 0)
+			{
+				break;
+			}
+			/* Waiting like the main loop does, so a hangup or a resize is still handled */
+			editorWaitEvent(left);
+			if(conf.winch)
+			{
+				editorResize();
+				clearScreen();
+			}
+			continue;
+		}
+		deadline = 0;
+		abAppend(&text, &c, 1);
+		if(c == '~' && text.len >= 6 && memcmp(&text.b[text.len - 6], endmark, 6) == 0)
 		{
-			abAppend(ab, " ", 1);
-			len++;
+			text.len -= 6;
+			break;
 		}
 	}
-	abAppend(ab, "\x1b[m", 3);
-	abAppend(ab, "\r\n", 2);
-}
-
-void messageBar(struct abuf *ab)
-{
-	abAppend(ab, "\x1b[K", 3);
-	int msglen = strlen(conf.status_message);
-	if(msglen > conf.screencols)
-	{
-		msglen = conf.screencols;
-	}
-	if(msglen && time(NULL) - conf.status_message_time < 5)
+	if(text.len > 0)
 	{
-		abAppend(ab, conf.status_message, msglen);
+		editorInsertText(text.b, text.len);
 	}
+	abFree(&text);
 }
 
-/*Function for clearing user's screen*/
-void clearScreen() 
-{
-	editorScroll();
-	struct abuf ab = ABUF_INIT;
-	
-	abAppend(&ab, "\x1b[?25l", 6);
-	abAppend(&ab, "\x1b[H", 3);
-
-	editorRowDraw(&ab);
-	statusBar(&ab);
-	messageBar(&ab);
-	
-	char buf[32];
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (conf.cy - conf.rowoff) + 1, conf.cx + 1);
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", conf.cy + 1, conf.cx + 1);
-	snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (conf.cy - conf.rowoff) + 1,
-                                            (conf.rx - conf.coloff) + 1);
-	abAppend(&ab, buf, strlen(buf));	
-	abAppend(&ab, "\x1b[?25h", 6);
-
-	write(STDOUT_FILENO, ab.b, ab.len);
-	abFree(&ab);
-}
-
-void statusMessage(const char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	vsnprintf(conf.status_message, sizeof(conf.status_message), fmt, ap);
-	va_end(ap);
-	conf.status_message_time = time(NULL);
-	
-}
-/* ====== INPUT ====== */
 /* Function for prompting user for a text file in the status bar */
-char *editorPrompt(char *prompt)
+/* Asking the user for a line of text in the status bar, callback is called after every key with what is typed so far */
+char *editorPrompt(char *prompt, void (*callback)(char *, int))
 {
 	size_t bufsize = 128;
 	char *buf = malloc(bufsize); /* Allocating bufsize and returning a pointer to it*/
@@ -727,14 +6958,21 @@ char *editorPrompt(char *prompt)
 		      	if (buflen != 0) buf[--buflen] = '\0';
    		}else if (c == '\x1b') {
    			statusMessage("");
+			if(callback)
+			{
+				callback(buf, c);
+			}
   			free(buf);
      			return NULL;
     		}else if (c == '\r')
 	        {
-      			if (buflen != 0) {
+			/* An empty answer is allowed, replacing with nothing deletes the matches */
         		statusMessage("");
+			if(callback)
+			{
+				callback(buf, c);
+			}
        			return buf;
-     		}
     		}else if (!iscntrl(c) && c < 128) 
 		{
       			if (buflen == bufsize - 1)
@@ -745,12 +6983,20 @@ char *editorPrompt(char *prompt)
       			buf[buflen++] = c;
       			buf[buflen] = '\0';
     		}
+		if(callback)
+		{
+			callback(buf, c);
+		}
   	}
     }
 /*Function for moving user's cursor in the editor*/
 void cursorMove(int key)
 {
-	editor_row *row = (conf.cy >= conf.numrows) ? NULL : &conf.row[conf.cy];
+	if(key == DOWN || key == RIGHT)
+	{
+		editorLoadWait(conf.cy + 2); /* The row below the cursor may not be loaded yet */
+	}
+	editor_row *row = (conf.cy >= conf.numrows) ? NULL : editorRowAt(conf.cy);
 	
 	switch(key)
 	{
@@ -762,7 +7008,7 @@ void cursorMove(int key)
 			}else if(conf.cy > 0) /* If the user presses left arrow key, it will jump to end of the text line*/
 			{
 				conf.cy--;
-				conf.cx = conf.row[conf.cy].size;
+				conf.cx = editorRowAt(conf.cy)->size;
 			}
 			break;
 		case RIGHT:
@@ -790,7 +7036,7 @@ void cursorMove(int key)
 			break;
 	}
 	/* Now the cursor will just snap to the end of the text line */
-	row = (conf.cy >= conf.numrows) ? NULL : &conf.row[conf.cy];
+	row = (conf.cy >= conf.numrows) ? NULL : editorRowAt(conf.cy);
 	int rowlen = row ? row->size : 0;
 	if(conf.cx > rowlen)
 	{
@@ -802,19 +7048,25 @@ void cursorMove(int key)
 void editorProcessKeypress()
 {
 	static int quit_times = SIMPLR_QUIT_TIMES;
+	static int close_times = SIMPLR_QUIT_TIMES;
+	long long keystart = perfNowNs();
 	int c = editorReadKey();
+	long long start = perfRecord(PERF_DECODE, keystart);
+	conf.undo.group++; /* Every edit this key makes is undone together */
 	switch(c)
 	{
 		case '\r':
 			editorNewLine();
 			break;
 	    	case CTRL_KEY('q'):
-      			if (conf.dirty_flag && quit_times > 0) {
-			        statusMessage("WARNING! File has unsaved changes. "
-          				"Press CTRL + Q %d more times to quit.", quit_times);
+			editorBufferSaveWait(); /* Saves that are still running are finished first */
+      			if ((conf.dirty_flag || editorBufferOthersDirty()) && quit_times > 0) {
+			        statusMessage("WARNING! %s has unsaved changes. "
+          				"Press CTRL + Q %d more times to quit.", conf.dirty_flag ? "File" : "Another buffer", quit_times);
 			        quit_times--;
 			        return;
 			}
+			editorBufferDiscardJournals(); /* Quitting drops the unsaved edits, so the journals go with them */
 	  	        write(STDOUT_FILENO, "\x1b[2J", 4);
 			write(STDOUT_FILENO, "\x1b[H", 3);
 			exit(0);
@@ -822,6 +7074,49 @@ void editorProcessKeypress()
 		case CTRL_KEY('s'):
 			saveChanges();
 			break; 
+		case CTRL_KEY('o'):
+			editorBufferOpen();
+			break;
+		case CTRL_KEY('t'):
+			if(conf.follow.active)
+			{
+				editorFollowStop();
+				statusMessage("Stopped following %s", conf.filename);
+			}
+			else
+			{
+				editorFollowStart();
+			}
+			break;
+		case CTRL_KEY('n'):
+			editorBufferSwitch((conf.buffer + 1) % conf.nbuffers);
+			break;
+		case CTRL_KEY('w'):
+			editorSaveWait(1);
+			if(conf.dirty_flag && close_times > 0)
+			{
+				statusMessage("WARNING! File has unsaved changes. "
+						"Press CTRL + W %d more times to close it.", close_times);
+				close_times--;
+				return;
+			}
+			editorBufferClose();
+			break;
+		case CTRL_KEY('f'):
+			editorFind(0);
+			break;
+		case CTRL_KEY('g'):
+			editorFind(1);
+			break;
+		case CTRL_KEY('r'):
+			editorReplace();
+			break;
+		case CTRL_KEY('z'):
+			editorUndoStep(-1);
+			break;
+		case CTRL_KEY('y'):
+			editorUndoStep(1);
+			break;
 			
 		/* If home key is pressed, cursor moves to beginning */
 		case HOME:
@@ -831,7 +7126,7 @@ void editorProcessKeypress()
 		case END:
 			if(conf.cy < conf.numrows)
 			{
-				conf.cx = conf.row[conf.cy].size; 
+				conf.cx = editorRowAt(conf.cy)->size; 
 			}	
 			break;
 		case BACKSPACE:
@@ -852,6 +7147,7 @@ void editorProcessKeypress()
 					conf.cy = conf.rowoff;
 				}else if(c == PAGE_DOWN)
 				{
+					editorLoadWait(conf.rowoff + 2 * conf.screenrows);
 					conf.cy = conf.rowoff + conf.screenrows - 1;
 					if(conf.cy > conf.numrows)
 					{
@@ -874,6 +7170,15 @@ void editorProcessKeypress()
 			break;
 			
 		case CTRL_KEY('l'):
+			editorFrameInvalidate();
+			break;
+		case CTRL_KEY('p'):
+			conf.perf_overlay = !conf.perf_overlay;
+			break;
+		case PASTE_START:
+			editorPaste();
+			break;
+		case PASTE_END:
 		case '\x1b':
 			break;
 
@@ -882,24 +7187,342 @@ void editorProcessKeypress()
 			break;
 
 	}
+	perf.last_key_ns = perfRecord(PERF_EDIT, start) - keystart;
+	perf.keys++;
 	quit_times = SIMPLR_QUIT_TIMES;
+	close_times = SIMPLR_QUIT_TIMES;
+}
+
+/* ====== BENCHMARK ======*/
+/* simplr --bench <script> replays keys from a script into /dev/null and reports how long every stage took.
+ * A script has one command per line, lines starting with # are comments:
+ *   size <rows> <cols>      size of the screen that is drawn
+ *   file <path> <bytes>     writes a file of C code unless one of that size is there already
+ *   open <path>             opens a file and draws the first screen
+ *   goto <line>             moves the cursor to a line, once the file is loaded up to it
+ *   keys <count> <text>     types text count times, \r \n \t \e \\ and \xHH are escapes
+ *   paste <bytes>           pastes that much C code at once
+ *   follow                  follows the open file
+ *   append <bytes> <count>  appends that much C code to the followed file count times, reading it after each */
+const char *benchLines[] = {
+	"/* Generated for benchmarking, block %d */", /* Numbered so that no two screens look the same */
+	"static int counter_update(struct counter *c, int delta)",
+	"{",
+	"\tif(c == NULL || delta == 0) // nothing to do",
+	"\t{",
+	"\t\treturn -1;",
+	"\t}",
+	"\tc->value += delta * 42 + 0x1f;",
+	"\tprintf(\"counter %s is now %d\\n\", c->name, c->value);",
+	"\treturn c->value;",
+	"}",
+	""
+};
+
+/* Appending bytes of generated C code to out, the text is made of whole lines except at the very end */
+void benchGenerate(struct abuf *out, size_t bytes)
+{
+	static int block = 0;
+	size_t nlines = sizeof(benchLines) / sizeof(benchLines[0]);
+	size_t done = 0;
+	int j = 0;
+	while(done < bytes)
+	{
+		char first[64];
+		const char *text = benchLines[j];
+		if(j == 0)
+		{
+			snprintf(first, sizeof(first), benchLines[0], block++);
+			text = first;
+		}
+		int len = strlen(text);
+		if(done + len + 1 > bytes)
+		{
+			len = bytes - done - 1;
+		}
+		abAppend(out, text, len);
+		abAppend(out, "\n", 1);
+		done += len + 1;
+		j = (j + 1) % nlines;
+	}
+}
+
+int benchMakeFile(const char *path, long long bytes)
+{
+	struct stat st;
+	if(stat(path, &st) == 0 && st.st_size == bytes)
+	{
+		return 0;
+	}
+	FILE *f = fopen(path, "w");
+	if(f == NULL)
+	{
+		return -1;
+	}
+	/* Written a block at a time, so files of several gigabytes don't have to fit in memory */
+	struct abuf block = ABUF_INIT;
+	long long left = bytes;
+	while(left > 0)
+	{
+		block.len = 0;
+		benchGenerate(&block, left < (4 << 20) ? left : (4 << 20));
+		fwrite(block.b, 1, block.len, f);
+		left -= block.len;
+	}
+	abFree(&block);
+	return fclose(f);
+}
+
+/* Turning the escapes of a keys command into the bytes a terminal would send */
+void benchUnescape(struct abuf *out, const char *s)
+{
+	while(*s)
+	{
+		char c = *s++;
+		if(c == '\\' && *s)
+		{
+			c = *s++;
+			switch(c)
+			{
+				case 'r': c = '\r'; break;
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'e': c = '\x1b'; break;
+				case 'x':
+					{
+						char hex[3] = {0, 0, 0};
+						int k;
+						for(k = 0; k < 2 && isxdigit((unsigned char)*s); k++)
+						{
+							hex[k] = *s++;
+						}
+						c = strtol(hex, NULL, 16);
+					}
+					break;
+			}
+		}
+		abAppend(out, &c, 1);
+	}
+}
+
+/* Handling every key of a step the way the main loop does, with the screen drawn after each one */
+void benchReplay(struct abuf *bytes, struct perfHistogram *keys)
+{
+	struct benchKeys replay = {bytes->b, bytes->len, 0};
+	conf.bench = &replay;
+	while(conf.input_head != conf.input_tail || replay.pos < replay.len)
+	{
+		long long start = perfNowNs();
+		editorProcessKeypress();
+		clearScreen();
+		perfHistogramAdd(keys, perfNowNs() - start);
+	}
+}
+
+void benchPrintRow(FILE *out, const char *name, struct perfHistogram *h)
+{
+	fprintf(out, "%-9s %10lld %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, h->count,
+			h->count ? h->total / 1000.0 / h->count : 0.0,
+			perfPercentile(h, 0.5) / 1000.0, perfPercentile(h, 0.9) / 1000.0,
+			perfPercentile(h, 0.99) / 1000.0, h->max / 1000.0);
+}
+
+int editorBench(const char *script)
+{
+	struct benchKeys none = {NULL, 0, 0};
+	conf.bench = &none;
+	FILE *in = fopen(script, "r");
+	if(in == NULL)
+	{
+		perror(script);
+		return 1;
+	}
+	/* The report goes where stdout went, the screen goes to /dev/null */
+	FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+	int null = open("/dev/null", O_WRONLY);
+	if(out == NULL || null == -1 || dup2(null, STDOUT_FILENO) == -1)
+	{
+		perror("bench");
+		return 1;
+	}
+	close(null);
+	editorInitLock();
+	editorInitEvents();
+	initEditor();
+	fprintf(out, "simplr bench: %s\n", script);
+
+	struct perfHistogram keys, appends;
+	memset(&keys, 0, sizeof(keys));
+	memset(&appends, 0, sizeof(appends));
+	char *line = NULL;
+	size_t linecap = 0;
+	ssize_t linelen;
+	long long total = perfNowNs();
+	while((linelen = getline(&line, &linecap, in)) != -1)
+	{
+		while(linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+		{
+			line[--linelen] = '\0';
+		}
+		if(linelen == 0 || line[0] == '#')
+		{
+			continue;
+		}
+		char path[PATH_MAX];
+		long long a, b;
+		int textat = 0;
+		long long start = perfNowNs();
+		if(sscanf(line, "size %lld %lld", &a, &b) == 2 && a > 2 && b > 0)
+		{
+			conf.screenrows = a - 2;
+			conf.screencols = b;
+			editorFrameInvalidate();
+		}else if(sscanf(line, "file %4095s %lld", path, &a) == 2)
+		{
+			if(benchMakeFile(path, a) != 0)
+			{
+				perror(path);
+				return 1;
+			}
+		}else if(sscanf(line, "open %4095s", path) == 1)
+		{
+			editorOpen(path);
+			clearScreen();
+		}else if(sscanf(line, "goto %lld", &a) == 1)
+		{
+			editorLoadWait(a + 1);
+			conf.cy = a < conf.numrows ? a : conf.numrows;
+			conf.cx = 0;
+			clearScreen();
+		}else if(sscanf(line, "keys %lld %n", &a, &textat) == 1 && textat > 0)
+		{
+			struct abuf once = ABUF_INIT, bytes = ABUF_INIT;
+			benchUnescape(&once, &line[textat]);
+			while(a-- > 0)
+			{
+				abAppend(&bytes, once.b, once.len);
+			}
+			benchReplay(&bytes, &keys);
+			abFree(&once);
+			abFree(&bytes);
+		}else if(sscanf(line, "paste %lld", &a) == 1)
+		{
+			struct abuf bytes = ABUF_INIT;
+			abAppend(&bytes, "\x1b[200~", 6);
+			benchGenerate(&bytes, a);
+			abAppend(&bytes, "\x1b[201~", 6);
+			benchReplay(&bytes, &keys);
+			abFree(&bytes);
+		}else if(strcmp(line, "follow") == 0)
+		{
+			editorFollowStart();
+			while(conf.follow.more)
+			{
+				editorFollowRead();
+			}
+			clearScreen();
+		}else if(sscanf(line, "append %lld %lld", &a, &b) == 2 && conf.follow.active)
+		{
+			struct abuf bytes = ABUF_INIT;
+			int fd = open(conf.filename, O_WRONLY | O_APPEND);
+			while(fd != -1 && b-- > 0)
+			{
+				bytes.len = 0;
+				benchGenerate(&bytes, a);
+				long long step = perfNowNs();
+				if(write(fd, bytes.b, bytes.len) != bytes.len)
+				{
+					break;
+				}
+				/* The way the main loop reads an append, a chunk at a time with the screen drawn after each */
+				conf.follow.more = 1;
+				while(conf.follow.more)
+				{
+					editorFollowRead();
+					clearScreen();
+				}
+				perfHistogramAdd(&appends, perfNowNs() - step);
+			}
+			if(fd == -1 || b >= 0)
+			{
+				perror(conf.filename);
+				return 1;
+			}
+			close(fd);
+			abFree(&bytes);
+		}else
+		{
+			fprintf(stderr, "%s: can't run \"%s\"\n", script, line);
+			return 1;
+		}
+		fprintf(out, "  %-50.50s %12.1f ms\n", line, (perfNowNs() - start) / 1e6);
+	}
+	free(line);
+	fclose(in);
+	/* Saves and journal writes still running are finished first, a save cut short by exit leaves its temporary file */
+	editorBufferSaveWait();
+	editorJournalFlush(1);
+	editorBufferLoadStop(); /* The rest of a file the script didn't move to isn't loaded */
+	fprintf(out, "total %.1f ms\n\n", (perfNowNs() - total) / 1e6);
+
+	/* Percentiles are the upper bounds of power of two buckets */
+	fprintf(out, "%-9s %10s %10s %10s %10s %10s %10s   (microseconds)\n", "phase", "count", "mean", "p50", "p90", "p99", "max");
+	benchPrintRow(out, "key", &keys);
+	benchPrintRow(out, "append", &appends);
+	int j;
+	for(j = 0; j < PERF_PHASES; j++)
+	{
+		benchPrintRow(out, perfPhaseNames[j], &perf.phase[j]);
+	}
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(out, "\nframes %lld, bytes written %lld (%lld per frame)\n", perf.frames, perf.bytes,
+			perf.frames ? perf.bytes / perf.frames : 0);
+	fprintf(out, "heap %lld KB in use, max resident %ld KB\n", perfHeapBytes() / 1024, ru.ru_maxrss);
+	fprintf(out, "row store: %lld KB in blocks, %lld KB of slabs, %lld large blocks of %lld KB\n", conf.store.used / 1024,
+			conf.store.slab_bytes / 1024, conf.store.large_blocks, conf.store.large_bytes / 1024);
+	fclose(out);
+	/* The edits of a benchmark aren't worth recovering */
+	editorJournalDiscard();
+	return 0;
 }
 
 /* ====== INITIALIZATION ======*/
+/* The main thread takes the rows for itself from the start, it only lets go of them while it waits */
+void editorInitLock()
+{
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init(&attr);
+	/* Keys are handled without waiting for all the workers that queue up for the rows */
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_init(&conf.rowlock, &attr);
+	pthread_rwlockattr_destroy(&attr);
+	pthread_rwlock_wrlock(&conf.rowlock);
+}
+
 /*Function to initialize all the fields in conf structure*/
 void initEditor()
 {
-	conf.cx = 0;
-	conf.cy = 0;
-	conf.numrows = 0;
-	conf.row = NULL;
-	conf.dirty_flag = 0; 
-	conf.rowoff = 0; /* We initialize it as 0 which means user will be scrolled to the top of the file by default*/
-	conf.coloff = 0;
-	conf.filename = NULL;
+	editorScanInit();
+	conf.buffers = calloc(1, sizeof(struct editorBuffer));
+	conf.nbuffers = 1;
+	conf.buffer = 0;
+	conf.files = NULL;
+	conf.inotify = -1;
+	editorBufferInit();
+	conf.frame = NULL;
+	conf.frame_rows = 0;
+	conf.input_head = conf.input_tail = 0;
+	conf.winch = 0;
+	conf.search = NULL;
 	conf.status_message[0] = '\0';
 	conf.status_message_time = 0;
-	if(getWindowSize(&conf.screenrows, &conf.screencols) == -1)
+	if(conf.bench)
+	{
+		/* Benchmarks draw into /dev/null, scripts can pick another size */
+		conf.screenrows = 24;
+		conf.screencols = 80;
+	}else if(getWindowSize(&conf.screenrows, &conf.screencols) == -1)
 	{
 		errorHandling("getWindowSize");
 	}
@@ -908,6 +7531,16 @@ void initEditor()
 
 int main(int argc, char *argv[])
 {
+	if(getenv("SIMPLR_TRACE"))
+	{
+		atexit(perfWriteTrace);
+	}
+	if(argc >= 3 && strcmp(argv[1], "--bench") == 0)
+	{
+		return editorBench(argv[2]);
+	}
+	editorInitLock();
+	editorInitEvents();
 	enableRawMode();
 	initEditor();
 	/* If user input passes this argument, the given file is open and read */
@@ -915,16 +7548,41 @@ int main(int argc, char *argv[])
 	{
 		editorOpen(argv[1]); /* Calling function for opening and reading given file */
 	}
+	/* Every other file gets a buffer of its own, the first one is shown */
+	int k;
+	for(k = 2; k < argc; k++)
+	{
+		editorBufferNew();
+		editorOpen(argv[k]);
+	}
+	editorBufferSwitch(0);
 	
-	statusMessage("Commands: CTRL + S = save | CTRL + Q = exit");
+	if(conf.status_message[0] == '\0')
+	{
+		statusMessage("Commands: CTRL + S = save | CTRL + Q = exit | CTRL + F = find | CTRL + G = regex find | CTRL + R = replace | CTRL + Z/Y = undo/redo | CTRL + O/N/W = open/next/close | CTRL + T = follow | CTRL + P = perf");
+	}
 	
 	while(1)
 	{
-		write(STDOUT_FILENO, "\x1b[2J", 4);
-		write(STDOUT_FILENO, "\x1b[H", 3);
 		clearScreen();
-		editorProcessKeypress();
-
+		/* Sleeping until a key arrives, the window is resized or the status message runs out */
+		editorWaitEvent(editorNextTimeout());
+		editorSaveWait(0);
+		editorLoadPoll();
+		editorJournalFlush(0);
+		if(conf.follow.active && conf.follow.more)
+		{
+			editorFollowRead();
+		}
+		if(conf.winch)
+		{
+			editorResize();
+		}
+		/* Every key that already arrived is handled before the screen is drawn again */
+		while(editorInputPending())
+		{
+			editorProcessKeypress();
+		}
 	}
 	return 0; 
 }